@@ -66,6 +66,11 @@ if(CMAKE_BUILD_TYPE STREQUAL "Debug")
     list(APPEND global_compile_definitions MOCK_COMMAND_LINE)
 endif()
 
+# validate every index passed to the LZW encoder
+if(CMAKE_BUILD_TYPE STREQUAL "Debug")
+    list(APPEND global_compile_definitions GIF_ENC_STRICT)
+endif()
+
 if(DEFINED DISABLE_LOGS)
     list(APPEND global_compile_definitions GENERAL_LOGGER_DISABLE)
 endif()
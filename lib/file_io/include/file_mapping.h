@@ -0,0 +1,129 @@
+#ifndef NAIVEIO_FILE_MAPPING_H
+#define NAIVEIO_FILE_MAPPING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+#include "file_utils.h"
+
+#ifdef _WIN32
+
+#include <windows.h>
+#else  // _WIN32
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // _WIN32
+
+namespace NaiveIO {
+
+/**
+ * @brief A whole file mapped read-only into memory, pages are only read when touched.
+ *        The data can be read by any number of threads at once.
+ */
+class FileMapping {
+  public:
+    using Ref = std::unique_ptr<FileMapping>;
+
+    /**
+     * @return nullptr if the file cannot be opened or mapped, or is empty.
+     */
+    static Ref
+    create(const std::string& fileName) noexcept {
+        const auto localized = checkFileExists(fileName);
+        if (localized.empty()) {
+            return nullptr;
+        }
+#ifdef _WIN32
+        const HANDLE file = CreateFileW(localized.c_str(),
+                                        GENERIC_READ,
+                                        FILE_SHARE_READ,
+                                        nullptr,
+                                        OPEN_EXISTING,
+                                        FILE_ATTRIBUTE_NORMAL,
+                                        nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return nullptr;
+        }
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+            CloseHandle(file);
+            return nullptr;
+        }
+        const HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping) {
+            return nullptr;
+        }
+        // the view keeps the mapping alive
+        void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!data) {
+            return nullptr;
+        }
+        const auto length = static_cast<size_t>(size.QuadPart);
+#else   // _WIN32
+        const int fd = open(localized.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st {};
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return nullptr;
+        }
+        const auto length = static_cast<size_t>(st.st_size);
+        // the mapping keeps the file alive
+        void* data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+#endif  // _WIN32
+        try {
+            return Ref(new FileMapping(static_cast<const uint8_t*>(data), length));
+        } catch (...) {
+            unmap(data, length);
+            return nullptr;
+        }
+    }
+
+    FileMapping(const FileMapping&) = delete;
+
+    FileMapping&
+    operator=(const FileMapping&) = delete;
+
+    ~FileMapping() noexcept {
+        unmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+
+    [[nodiscard]] std::span<const uint8_t>
+    getData() const noexcept {
+        return {m_data, m_size};
+    }
+
+  private:
+    FileMapping(const uint8_t* data, const size_t size) noexcept
+        : m_data(data), m_size(size) {}
+
+    static void
+    unmap(void* data, [[maybe_unused]] const size_t size) noexcept {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else   // _WIN32
+        munmap(data, size);
+#endif  // _WIN32
+    }
+
+    const uint8_t* m_data;
+    size_t m_size;
+};
+
+}  // namespace NaiveIO
+
+#endif  // NAIVEIO_FILE_MAPPING_H
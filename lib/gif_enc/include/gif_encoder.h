@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "def.h"
+#include "gif_palette_planner.h"
 
 namespace GIFEnc {
 class GIFEncoder {
@@ -34,6 +35,11 @@ class GIFEncoder {
      * @param minCodeLength If 0, the global one will be used.
      * @param palette       The color palette for the frame.
      *                      If empty, the global color table will be used.
+     *                      Entries not referenced by the frame will be dropped
+     *                      and the code length reduced if possible.
+     *                      If all referenced colors are also in the global
+     *                      color table and that is estimated to be smaller,
+     *                      the frame is remapped to it instead.
      */
     void
     addFrame(const std::span<const uint8_t>& frame,
@@ -70,6 +76,21 @@ class GIFEncoder {
                             const std::string& authentication,
                             const std::span<const uint8_t>& data);
 
+    /**
+     * @brief Merge consecutive frames with identical content by extending the
+     *        delay of the first one instead of writing them again.
+     *        Frames are held back until a different one arrives, so this must
+     *        not be used when every frame has to be kept, e.g. data-carrying ones.
+     */
+    void
+    enableFrameCoalescing(bool enable = true);
+
+    /**
+     * @brief Number of frames merged into their predecessor so far.
+     */
+    [[nodiscard]] size_t
+    getCoalescedFrames() const noexcept;
+
     bool
     finish();
 
@@ -83,6 +104,36 @@ class GIFEncoder {
     void
     writeFile(uint8_t byte);
 
+    // what a frame was generated from, equal keys are taken as identical frames:
+    // besides the 64 bit hash, the sizes and the encoding parameters have to match as well
+    struct FrameKey {
+        bool isCompressed       = false;
+        uint32_t disposalMethod = 0;
+        uint32_t minCodeLength  = 0;
+        size_t paletteSize      = 0;
+        size_t dataSize         = 0;
+        uint64_t hash           = 0;  // of the palette and the data
+
+        bool
+        operator==(const FrameKey&) const = default;
+    };
+
+    /**
+     * @brief Extend the delay of the pending frame if it has the same key, before the frame is encoded.
+     * @return true if the frame has been merged and must not be written.
+     */
+    bool
+    coalesceFrame(const FrameKey& key, uint32_t delay);
+
+    /**
+     * @brief Write the frame, or hold it back if coalescing is enabled.
+     */
+    void
+    writeFrame(std::vector<uint8_t>& frame, const FrameKey& key, uint32_t delay);
+
+    void
+    flushPendingFrame();
+
   private:
     WriteChunkCallback m_writeChunkCallback;
     uint32_t m_width            = 0;
@@ -91,6 +142,14 @@ class GIFEncoder {
     bool m_hasTransparency      = false;
     uint32_t m_transparentIndex = 0;
     std::vector<PixelBGRA> m_globalColorTable;
+    ColorLookup m_globalColorLookup;
+
+    bool m_coalesceFrames = false;
+    bool m_hasPendingFrame = false;
+    std::vector<uint8_t> m_pendingFrame;
+    FrameKey m_pendingKey;
+    uint32_t m_pendingDelay  = 0;  // in milliseconds
+    size_t m_coalescedFrames = 0;
 
     bool m_finished = false;
 };
@@ -16,6 +16,11 @@ using WriteCallback = std::function<void(const std::span<const uint8_t>&)>;
 using ReadCallback  = std::function<std::span<const uint8_t>()>;
 using ErrorCallback = std::function<void()>;
 
+/**
+ * @note The input data is expected to be smaller than 1 << minCodeSize.
+ *       It is only checked, with onError being called otherwise,
+ *       when built with GIF_ENC_STRICT, callers are expected to validate it.
+ */
 size_t
 compressStream(const ReadCallback& read,
                const WriteCallback& write,
@@ -30,12 +35,30 @@ decompressStream(const ReadCallback& read,
                  uint32_t minCodeSize         = 8,
                  size_t writeChunkSize        = WRITE_DEFAULT_CHUNK_SIZE) noexcept;
 
+/**
+ * @note See compressStream for the expected range of @p data.
+ */
 std::vector<uint8_t>
 compress(const std::span<const uint8_t>& data, uint32_t minCodeSize = 8) noexcept;
 
 std::vector<uint8_t>
 decompress(const std::span<const uint8_t>& data, uint32_t minCodeSize = 8) noexcept;
 
+/**
+ * @brief Count the codes (excluding clear and end codes) @p data would be compressed to.
+ *        The count does not depend on the actual values in @p data,
+ *        only on the positions where they repeat.
+ */
+size_t
+countCodes(const std::span<const uint8_t>& data, uint32_t minCodeSize = 8) noexcept;
+
+/**
+ * @brief Size in bytes of a compressed stream consisting of @p codeCount codes,
+ *        including clear and end codes.
+ */
+size_t
+getCompressedSize(size_t codeCount, uint32_t minCodeSize = 8) noexcept;
+
 };  // namespace LZW
 
 };  // namespace GIFEnc
@@ -0,0 +1,122 @@
+#ifndef GIF_PALETTE_PLANNER_H
+#define GIF_PALETTE_PLANNER_H
+
+#include <array>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "def.h"
+
+namespace GIFEnc {
+
+using UsedEntries = std::array<bool, 256>;
+using IndexMap    = std::array<uint8_t, 256>;
+using ColorLookup = std::unordered_map<uint32_t, uint8_t>;  // RGB -> index
+
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+/**
+ * @brief FNV-1a over the RGB values of @p palette, continuing from @p hash.
+ */
+uint64_t
+hashPalette(const std::vector<PixelBGRA>& palette, uint64_t hash = FNV_OFFSET_BASIS) noexcept;
+
+/**
+ * @brief FNV-1a over @p data taken 8 bytes at a time, continuing from @p hash.
+ */
+uint64_t
+hashBytes(const std::span<const uint8_t>& data, uint64_t hash = FNV_OFFSET_BASIS) noexcept;
+
+/**
+ * @brief Smallest valid code length for a color table with @p paletteSize entries.
+ */
+uint32_t
+getMinCodeLength(size_t paletteSize) noexcept;
+
+/**
+ * @brief Index the colors of @p palette, the transparent entry is skipped.
+ *        Only RGB is taken into account since that is what ends up in the file.
+ */
+ColorLookup
+makeColorLookup(const std::vector<PixelBGRA>& palette, bool hasTransparency, uint32_t transparentIndex) noexcept;
+
+/**
+ * @brief Find an index in @p target for each of the @p used entries of @p palette.
+ *        The transparent index is mapped to itself.
+ *
+ * @return std::nullopt if any of the used colors is missing from @p target.
+ */
+std::optional<IndexMap>
+mapToPalette(const std::vector<PixelBGRA>& palette,
+             const UsedEntries& used,
+             const ColorLookup& target,
+             bool hasTransparency,
+             uint32_t transparentIndex) noexcept;
+
+/**
+ * @brief Estimate the number of LZW codes of a frame from a leading sample of it.
+ */
+size_t
+estimateCodeCount(const std::span<const uint8_t>& frame, uint32_t minCodeLength) noexcept;
+
+/**
+ * @brief Decides whether a global color table pays off for a sequence of frames
+ *        that come with their own palettes, and which one to use.
+ *
+ * A frame can reference the global color table instead of carrying a local one
+ * if every color it uses is present in it. This saves the local color table
+ * but may widen the LZW codes, both are taken into account.
+ */
+class PalettePlanner {
+  public:
+    struct Plan {
+        std::vector<PixelBGRA> globalColorTable;  // empty if local palettes are cheaper
+        uint32_t minCodeLength = 0;               // of the global color table
+        size_t sharedFrames    = 0;               // frames expected to use the global color table
+        size_t estimatedSaving = 0;               // in bytes
+    };
+
+    PalettePlanner(uint32_t width, uint32_t height, bool hasTransparency, uint32_t transparentIndex) noexcept;
+
+    /**
+     * @brief Register the palette of a frame.
+     * @param palette   The local palette of the frame.
+     * @param frame     The frame data as indexes in palette.
+     *                  If empty, all entries are considered used and the frame
+     *                  is assumed to compress to one code per two pixels.
+     */
+    void
+    addFrame(const std::vector<PixelBGRA>& palette, const std::span<const uint8_t>& frame = {});
+
+    /**
+     * @brief Pick the global color table among the registered palettes
+     *        that minimizes the estimated total size.
+     *        Identical palettes are only considered once.
+     */
+    [[nodiscard]] Plan
+    plan() const noexcept;
+
+  private:
+    struct FrameInfo {
+        size_t paletteId = 0;
+        UsedEntries used{};
+        uint32_t minCodeLength = 0;  // after dropping unused entries
+        size_t codeCount       = 0;
+    };
+
+    uint32_t m_width            = 0;
+    uint32_t m_height           = 0;
+    bool m_hasTransparency      = false;
+    uint32_t m_transparentIndex = 0;
+
+    std::vector<std::vector<PixelBGRA>> m_palettes;           // distinct palettes
+    std::vector<size_t> m_paletteUses;                         // frames per distinct palette
+    std::unordered_multimap<uint64_t, size_t> m_paletteIndex;  // hash -> distinct palette
+    std::vector<FrameInfo> m_frames;
+};
+
+};  // namespace GIFEnc
+
+#endif  // GIF_PALETTE_PLANNER_H
@@ -1,5 +1,7 @@
 #include "gif_encoder.h"
 
+#include <array>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -7,8 +9,17 @@
 #include "gif_exception.h"
 #include "gif_format.h"
 #include "gif_lzw.h"
+#include "gif_palette_planner.h"
 using std::vector, std::span, std::string;
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GIF_ENC_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define GIF_ENC_NEON
+#include <arm_neon.h>
+#endif
+
 static bool
 checkCodeLengthValid(uint32_t minCodeLength, size_t paletteSize) {
     if (minCodeLength < 2 || minCodeLength > 8) {
@@ -20,15 +31,119 @@ checkCodeLengthValid(uint32_t minCodeLength, size_t paletteSize) {
     return true;
 }
 
+// largest value in @p codes, 0 if empty
+static uint8_t
+getMaxIndex(const std::span<const uint8_t>& codes) {
+    const uint8_t* p   = codes.data();
+    const uint8_t* end = p + codes.size();
+    uint8_t ret        = 0;
+#if defined(GIF_ENC_SSE2)
+    if (end - p >= 16) {
+        __m128i acc = _mm_setzero_si128();
+        for (; end - p >= 16; p += 16) {
+            acc = _mm_max_epu8(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        }
+        // fold the 16 lanes
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 8));
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 4));
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 2));
+        acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 1));
+        ret = static_cast<uint8_t>(_mm_cvtsi128_si32(acc) & 0xFF);
+    }
+#elif defined(GIF_ENC_NEON)
+    if (end - p >= 16) {
+        uint8x16_t acc = vdupq_n_u8(0);
+        for (; end - p >= 16; p += 16) {
+            acc = vmaxq_u8(acc, vld1q_u8(p));
+        }
+        ret = vmaxvq_u8(acc);
+    }
+#endif
+    for (; p < end; ++p) {
+        ret = *p > ret ? *p : ret;
+    }
+    return ret;
+}
+
 static bool
 checkIndexesValid(const std::span<const uint8_t>& codes, size_t paletteSize) {
-    const auto maxIndex = paletteSize - 1;
-    for (const auto& code : codes) {
-        if (code > maxIndex) {
-            return false;
+    return codes.empty() || getMaxIndex(codes) < paletteSize;
+}
+
+struct TrimmedFrame {
+    vector<uint8_t> frame;
+    vector<PixelBGRA> palette;
+    uint32_t minCodeLength    = 0;
+    uint32_t transparentIndex = 0;
+};
+
+/**
+ * @brief Flag the palette entries referenced by the frame.
+ *        The transparent index is always flagged since it has to stay addressable.
+ *
+ * @throws GIFEncodeException if the frame references indexes out of the palette.
+ */
+static GIFEnc::UsedEntries
+getUsedEntries(const span<const uint8_t>& frame,
+               const size_t paletteSize,
+               const bool hasTransparency,
+               const uint32_t transparentIndex) {
+    GIFEnc::UsedEntries used{};
+    for (const auto code : frame) {
+        used[code] = true;
+    }
+    for (size_t i = paletteSize; i < used.size(); ++i) {
+        if (used[i]) {
+            throw GIFEnc::GIFEncodeException("Color index out of range");
         }
     }
-    return true;
+    if (hasTransparency && transparentIndex < used.size()) {
+        used[transparentIndex] = true;
+    }
+    return used;
+}
+
+/**
+ * @brief Drop the palette entries that are never referenced by the frame and
+ *        remap the indexes to a dense palette.
+ *
+ * @return std::nullopt if the code length can not be reduced this way,
+ *         in which case the frame should be written as is.
+ */
+static std::optional<TrimmedFrame>
+trimPalette(const span<const uint8_t>& frame,
+            const vector<PixelBGRA>& palette,
+            const GIFEnc::UsedEntries& used,
+            const uint32_t minCodeLength,
+            const bool hasTransparency,
+            const uint32_t transparentIndex) {
+    GIFEnc::IndexMap remap{};
+    uint32_t usedCount = 0;
+    for (size_t i = 0; i < used.size(); ++i) {
+        if (used[i]) {
+            remap[i] = TOU8(usedCount++);
+        }
+    }
+    const uint32_t mcl = GIFEnc::getMinCodeLength(usedCount);
+    if (mcl >= minCodeLength) {
+        return std::nullopt;
+    }
+
+    TrimmedFrame ret;
+    ret.minCodeLength    = mcl;
+    ret.transparentIndex = hasTransparency ? remap[transparentIndex] : 0;
+    // padded to the full table size to keep it valid for tiny palettes
+    ret.palette.resize(1u << mcl, makeBGRA(0, 0, 0));
+    for (size_t i = 0; i < used.size(); ++i) {
+        if (used[i] && i < palette.size()) {
+            ret.palette[remap[i]] = palette[i];
+        }
+    }
+    ret.frame.resize(frame.size());
+    for (size_t i = 0; i < frame.size(); ++i) {
+        ret.frame[i] = remap[frame[i]];
+    }
+    return ret;
 }
 
 GIFEnc::GIFEncoder::GIFEncoder(const WriteChunkCallback& writeChunkCallback,
@@ -57,9 +172,13 @@ GIFEnc::GIFEncoder::GIFEncoder(const WriteChunkCallback& writeChunkCallback,
                                              std::to_string(globalColorTable.size()));
         }
     }
-    if (hasTransparency && (transparentIndex >= globalColorTable.size())) {
+    // without a global color table the index refers to the local ones
+    if (hasTransparency && (transparentIndex >= (hasGlobalColorTable ? globalColorTable.size() : 256))) {
         throw GIFEnc::GIFEncodeException("Transparent index out of range");
     }
+    if (hasGlobalColorTable) {
+        m_globalColorLookup = GIFEnc::makeColorLookup(m_globalColorTable, m_hasTransparency, m_transparentIndex);
+    }
     auto header = GIFEnc::gifHeader(
         m_width,
         m_height,
@@ -101,23 +220,75 @@ GIFEnc::GIFEncoder::addFrame(
         throw GIFEnc::GIFEncodeException("Frame size mismatch");
     }
 
+    FrameKey key;
+    if (m_coalesceFrames) {
+        const uint64_t hash = GIFEnc::hashBytes(frame, GIFEnc::hashPalette(palette));
+        key                 = {false, disposalMethod, minCodeLength, palette.size(), frame.size(), hash};
+        if (coalesceFrame(key, delay)) {
+            return;
+        }
+    }
+
     uint32_t mcl;
+    uint32_t transparentIndex         = m_transparentIndex;
     const std::vector<PixelBGRA>* pal = nullptr;
+    span<const uint8_t> data          = frame;
+    std::optional<TrimmedFrame> trimmed;
+    vector<uint8_t> remapped;
 
-    if (minCodeLength == 0) {
-        mcl = m_minCodeLength;
+    if (minCodeLength == 0 || palette.empty()) {
+        mcl = minCodeLength == 0 ? m_minCodeLength : minCodeLength;
+        if (mcl != m_minCodeLength) {
+            throw GIFEnc::GIFEncodeException("Invalid min code size");
+        }
+        // the only check of the indexes, the LZW encoder does not repeat it
+        if (!checkIndexesValid(frame, 1ull << mcl)) {
+            throw GIFEnc::GIFEncodeException("Color index out of range");
+        }
     } else {
         mcl = minCodeLength;
-        if (!palette.empty()) {
-            if (!checkCodeLengthValid(mcl, palette.size())) {
-                throw GIFEnc::GIFEncodeException("Color table size mismatch");
-            }
+        if (!checkCodeLengthValid(mcl, palette.size())) {
+            throw GIFEnc::GIFEncodeException("Color table size mismatch");
+        }
+        pal = &palette;
+        // nothing to trim or remap, a plain range check is enough
+        if (mcl <= 2 && m_globalColorTable.empty()) {
             if (!checkIndexesValid(frame, palette.size())) {
                 throw GIFEnc::GIFEncodeException("Color index out of range");
             }
-            pal = &palette;
-        } else if (mcl != m_minCodeLength) {
-            throw GIFEnc::GIFEncodeException("Invalid min code size");
+        } else {
+            // also validates the indexes
+            const auto used = getUsedEntries(frame, palette.size(), m_hasTransparency, m_transparentIndex);
+            trimmed         = trimPalette(frame, palette, used, mcl, m_hasTransparency, m_transparentIndex);
+            if (trimmed) {
+                mcl              = trimmed->minCodeLength;
+                transparentIndex = trimmed->transparentIndex;
+                pal              = &trimmed->palette;
+                data             = trimmed->frame;
+            }
+            // reference the global color table instead if it holds all the colors
+            // and skipping the local one outweighs the possibly wider codes
+            const auto map = m_globalColorTable.empty()
+                                 ? std::nullopt
+                                 : GIFEnc::mapToPalette(palette, used, m_globalColorLookup, m_hasTransparency, m_transparentIndex);
+            if (map) {
+                bool useGlobal = m_minCodeLength <= mcl;
+                if (!useGlobal) {
+                    const size_t codes = GIFEnc::estimateCodeCount(data, mcl);
+                    useGlobal          = GIFEnc::LZW::getCompressedSize(codes, m_minCodeLength) <=
+                                GIFEnc::LZW::getCompressedSize(codes, mcl) + 3 * (1ull << mcl);
+                }
+                if (useGlobal) {
+                    remapped.resize(frame.size());
+                    for (size_t i = 0; i < frame.size(); ++i) {
+                        remapped[i] = (*map)[frame[i]];
+                    }
+                    mcl              = m_minCodeLength;
+                    transparentIndex = m_transparentIndex;
+                    pal              = nullptr;
+                    data             = remapped;
+                }
+            }
         }
     }
 
@@ -125,7 +296,7 @@ GIFEnc::GIFEncoder::addFrame(
                                          m_height,
                                          delay,
                                          m_hasTransparency,
-                                         m_transparentIndex,
+                                         transparentIndex,
                                          disposalMethod,
                                          mcl,
                                          pal ? *pal : vector<PixelBGRA>{});
@@ -136,10 +307,10 @@ GIFEnc::GIFEncoder::addFrame(
 
     bool isFirst          = true;
     const auto compressed = GIFEnc::LZW::compressStream(
-        [&frame, &isFirst]() -> span<const uint8_t> {
+        [&data, &isFirst]() -> span<const uint8_t> {
             if (isFirst) {
                 isFirst = false;
-                return {frame.data(), frame.size()};
+                return {data.data(), data.size()};
             } else {
                 return {};
             }
@@ -157,7 +328,7 @@ GIFEnc::GIFEncoder::addFrame(
     }
 
     buffer.push_back(0);
-    writeFile(buffer);
+    writeFrame(buffer, key, delay);
 }
 
 void
@@ -177,6 +348,15 @@ GIFEnc::GIFEncoder::addFrameCompressed(
             "empty");
     }
 
+    FrameKey key;
+    if (m_coalesceFrames) {
+        const uint64_t hash = GIFEnc::hashBytes(frame, GIFEnc::hashPalette(palette));
+        key                 = {true, disposalMethod, minCodeLength, palette.size(), frame.size(), hash};
+        if (coalesceFrame(key, delay)) {
+            return;
+        }
+    }
+
     uint32_t mcl;
     const std::vector<PixelBGRA>* pal = nullptr;
 
@@ -214,7 +394,7 @@ GIFEnc::GIFEncoder::addFrameCompressed(
     } else {
         buffer.insert(buffer.end(), frame.begin(), frame.end());
     }
-    writeFile(buffer);
+    writeFrame(buffer, key, delay);
 }
 
 void
@@ -228,14 +408,72 @@ GIFEnc::GIFEncoder::addApplicationExtension(const string& identifier,
     if (ext.empty()) {
         throw GIFEnc::GIFEncodeException("Extension generation failed");
     }
+    flushPendingFrame();
     writeFile(ext);
 }
 
+void
+GIFEnc::GIFEncoder::enableFrameCoalescing(const bool enable) {
+    if (!enable) {
+        flushPendingFrame();
+    }
+    m_coalesceFrames = enable;
+}
+
+size_t
+GIFEnc::GIFEncoder::getCoalescedFrames() const noexcept {
+    return m_coalescedFrames;
+}
+
+bool
+GIFEnc::GIFEncoder::coalesceFrame(const FrameKey& key, const uint32_t delay) {
+    if (!m_hasPendingFrame || key != m_pendingKey) {
+        return false;
+    }
+    // the merged delay has to fit in the 16 bit field, in centiseconds
+    if ((static_cast<uint64_t>(m_pendingDelay) + delay) / 10 > 0xFFFF) {
+        return false;
+    }
+    m_pendingDelay += delay;
+    ++m_coalescedFrames;
+    return true;
+}
+
+void
+GIFEnc::GIFEncoder::writeFrame(vector<uint8_t>& frame, const FrameKey& key, const uint32_t delay) {
+    if (!m_coalesceFrames) {
+        writeFile(frame);
+        return;
+    }
+    flushPendingFrame();
+    m_pendingFrame    = std::move(frame);
+    m_pendingKey      = key;
+    m_pendingDelay    = delay;
+    m_hasPendingFrame = true;
+}
+
+void
+GIFEnc::GIFEncoder::flushPendingFrame() {
+    if (!m_hasPendingFrame) {
+        return;
+    }
+    m_hasPendingFrame = false;
+    // the frame starts with its graphic control extension:
+    // 0x21 0xF9 0x04 <packed fields> <delay, little endian> ...
+    const uint32_t delay = m_pendingDelay / 10;
+    m_pendingFrame[4]    = TOU8(delay & 0xFFu);
+    m_pendingFrame[5]    = TOU8(delay >> 8);
+    writeFile(m_pendingFrame);
+    m_pendingFrame.clear();
+    m_pendingKey = {};
+}
+
 bool
 GIFEnc::GIFEncoder::finish() {
     if (m_finished) {
         return false;
     }
+    flushPendingFrame();
     writeFile(GIFEnc::GIF_END);
     m_finished = true;
     return true;
@@ -27,6 +27,11 @@ class LZWCompressImpl {
         return m_isFinished;
     }
 
+    [[nodiscard]] size_t
+    getCodeCount() const {
+        return m_codeCount;
+    }
+
   private:
     void
     _pushCode(uint16_t code);
@@ -51,6 +56,8 @@ class LZWCompressImpl {
     LZWNode* m_dict     = nullptr;  // memory pool. index: code + 1; value: node. 0 is reserved for null
     uint16_t m_currNode = 0;        // pointer to current node
 
+    size_t m_codeCount = 0;  // data codes pushed
+
     bool m_isFinished = false;
 };
 
@@ -81,10 +88,12 @@ LZWCompressImpl::process(const span<const uint8_t>& input) {
     }
     for (size_t i = 0; i < input.size(); ++i) {
         const uint8_t& data = input[i];
+#ifdef GIF_ENC_STRICT
         if (data >= 1 << m_minCodeSize) {
             _onError();
             return;
         }
+#endif  // GIF_ENC_STRICT
         if (!m_currNode) {  // first data
             m_currNode = data + 1;
         } else {
@@ -92,6 +101,7 @@ LZWCompressImpl::process(const span<const uint8_t>& input) {
                 m_currNode = nextNode;
             } else {
                 _pushCode(m_currNode - 1);
+                ++m_codeCount;
                 if (m_nextCode < GIFEnc::LZW::MAX_DICT_SIZE) {
                     nextNode = m_nextCode + 1;  // create new node
                     if (m_nextCode >= m_maxCode) {
@@ -115,8 +125,10 @@ LZWCompressImpl::finish() {
     if (m_isFinished) return 0;
     m_isFinished = true;
 
-    if (m_currNode)  // push last node
+    if (m_currNode) {  // push last node
         _pushCode(m_currNode - 1);
+        ++m_codeCount;
+    }
     _pushCode(m_endCode);
     if (m_bufferSize) {
         m_result[m_resultSize++] = static_cast<uint8_t>(m_buffer);
@@ -202,4 +214,50 @@ GIFEnc::LZW::compress(const span<const uint8_t>& data, uint32_t minCodeSize) noe
     encoder.process(data);
     encoder.finish();
     return out;
+}
+
+size_t
+GIFEnc::LZW::countCodes(const span<const uint8_t>& data, uint32_t minCodeSize) noexcept {
+    if (minCodeSize < 2) {
+        return 0;
+    }
+    const WriteCallback discard = [](const span<const uint8_t>&) {};
+    const ErrorCallback onError = nullptr;
+    auto encoder                = LZWCompressImpl(discard, onError, minCodeSize, GIFEnc::LZW::WRITE_DEFAULT_CHUNK_SIZE);
+    encoder.process(data);
+    encoder.finish();
+    return encoder.getCodeCount();
+}
+
+size_t
+GIFEnc::LZW::getCompressedSize(size_t codeCount, uint32_t minCodeSize) noexcept {
+    if (minCodeSize < 2) {
+        return 0;
+    }
+    const size_t firstCode = (1u << minCodeSize) + 2;
+    // each code but the last one of a cycle adds an entry to the dictionary,
+    // and the code length grows once the next entry no longer fits.
+    // a full dictionary is followed by a clear code.
+    const size_t cycleCodes = MAX_DICT_SIZE - firstCode + 1;
+
+    size_t bits = minCodeSize + 1;  // leading clear code
+    while (codeCount > 0) {
+        const size_t codes = codeCount < cycleCodes ? codeCount : cycleCodes;
+        size_t pushed      = 0;
+        size_t entry       = firstCode;
+        uint32_t length    = minCodeSize + 1;
+        while (pushed < codes) {
+            // codes pushed with the current length
+            const size_t limit = length < MAX_CODE_SIZE ? (1u << length) - entry + 1 : codes - pushed;
+            const size_t n     = limit < codes - pushed ? limit : codes - pushed;
+            bits += n * length;
+            pushed += n;
+            entry += n;
+            if (length < MAX_CODE_SIZE) ++length;
+        }
+        codeCount -= codes;
+        if (codeCount > 0) bits += MAX_CODE_SIZE;  // clear code
+    }
+    bits += MAX_CODE_SIZE;  // end code, worst case
+    return (bits + 7) / 8;
 }
\ No newline at end of file
@@ -0,0 +1,231 @@
+#include "gif_palette_planner.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include "def.h"
+#include "gif_exception.h"
+#include "gif_lzw.h"
+using std::vector, std::span;
+
+static constexpr size_t SAMPLE_SIZE    = 65536;  // pixels compressed to estimate the code count of a frame
+static constexpr size_t MAX_CANDIDATES = 64;     // most used distinct palettes considered as global color table
+
+static inline uint32_t
+toRGB(const PixelBGRA& color) {
+    return color.toU32() & 0xFFFFFF;
+}
+
+static constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+uint64_t
+GIFEnc::hashPalette(const vector<PixelBGRA>& palette, uint64_t hash) noexcept {
+    for (const auto& color : palette) {
+        for (const uint8_t byte : {color.r, color.g, color.b}) {
+            hash ^= byte;
+            hash *= FNV_PRIME;
+        }
+    }
+    return hash;
+}
+
+uint64_t
+GIFEnc::hashBytes(const span<const uint8_t>& data, uint64_t hash) noexcept {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, sizeof(word));
+        hash ^= word;
+        hash *= FNV_PRIME;
+    }
+    for (; i < data.size(); ++i) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static bool
+isSamePalette(const vector<PixelBGRA>& a, const vector<PixelBGRA>& b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](const PixelBGRA& x, const PixelBGRA& y) {
+               return toRGB(x) == toRGB(y);
+           });
+}
+
+// LZW data plus the sub-block length bytes
+static size_t
+getFrameDataSize(const size_t codeCount, const uint32_t minCodeLength) {
+    const size_t size = GIFEnc::LZW::getCompressedSize(codeCount, minCodeLength);
+    return size + (size + 254) / 255;
+}
+
+uint32_t
+GIFEnc::getMinCodeLength(const size_t paletteSize) noexcept {
+    uint32_t mcl = 2;
+    while ((1ull << mcl) < paletteSize) {
+        ++mcl;
+    }
+    return mcl;
+}
+
+GIFEnc::ColorLookup
+GIFEnc::makeColorLookup(const vector<PixelBGRA>& palette,
+                        const bool hasTransparency,
+                        const uint32_t transparentIndex) noexcept {
+    ColorLookup lookup;
+    lookup.reserve(palette.size());
+    for (size_t i = 0; i < palette.size() && i < 256; ++i) {
+        if (hasTransparency && i == transparentIndex) {
+            continue;
+        }
+        lookup.try_emplace(toRGB(palette[i]), TOU8(i));
+    }
+    return lookup;
+}
+
+std::optional<GIFEnc::IndexMap>
+GIFEnc::mapToPalette(const vector<PixelBGRA>& palette,
+                     const UsedEntries& used,
+                     const ColorLookup& target,
+                     const bool hasTransparency,
+                     const uint32_t transparentIndex) noexcept {
+    IndexMap map{};
+    for (size_t i = 0; i < used.size(); ++i) {
+        if (!used[i]) {
+            continue;
+        }
+        if (hasTransparency && i == transparentIndex) {
+            map[i] = TOU8(transparentIndex);
+            continue;
+        }
+        if (i >= palette.size()) {
+            return std::nullopt;
+        }
+        const auto it = target.find(toRGB(palette[i]));
+        if (it == target.end()) {
+            return std::nullopt;
+        }
+        map[i] = it->second;
+    }
+    return map;
+}
+
+size_t
+GIFEnc::estimateCodeCount(const span<const uint8_t>& frame, const uint32_t minCodeLength) noexcept {
+    if (frame.size() <= SAMPLE_SIZE) {
+        return LZW::countCodes(frame, minCodeLength);
+    }
+    const size_t codes = LZW::countCodes(frame.subspan(0, SAMPLE_SIZE), minCodeLength);
+    return codes * frame.size() / SAMPLE_SIZE;
+}
+
+GIFEnc::PalettePlanner::PalettePlanner(const uint32_t width,
+                                       const uint32_t height,
+                                       const bool hasTransparency,
+                                       const uint32_t transparentIndex) noexcept
+    : m_width(width),
+      m_height(height),
+      m_hasTransparency(hasTransparency),
+      m_transparentIndex(transparentIndex) {}
+
+void
+GIFEnc::PalettePlanner::addFrame(const vector<PixelBGRA>& palette, const span<const uint8_t>& frame) {
+    if (palette.empty() || palette.size() > 256) {
+        throw GIFEncodeException("Color table size mismatch");
+    }
+
+    FrameInfo info;
+    if (frame.empty()) {
+        std::fill_n(info.used.begin(), palette.size(), true);
+        info.codeCount = static_cast<size_t>(m_width) * m_height / 2;
+    } else {
+        for (const auto code : frame) {
+            info.used[code] = true;
+        }
+        for (size_t i = palette.size(); i < info.used.size(); ++i) {
+            if (info.used[i]) {
+                throw GIFEncodeException("Color index out of range");
+            }
+        }
+        info.codeCount = estimateCodeCount(frame, getMinCodeLength(palette.size()));
+    }
+    if (m_hasTransparency && m_transparentIndex < info.used.size()) {
+        info.used[m_transparentIndex] = true;
+    }
+    info.minCodeLength = getMinCodeLength(std::count(info.used.begin(), info.used.end(), true));
+
+    const uint64_t hash = hashPalette(palette);
+    const auto [begin, end] = m_paletteIndex.equal_range(hash);
+    auto it = std::find_if(begin, end, [&](const auto& entry) { return isSamePalette(m_palettes[entry.second], palette); });
+    if (it != end) {
+        info.paletteId = it->second;
+    } else {
+        info.paletteId = m_palettes.size();
+        m_palettes.push_back(palette);
+        m_paletteUses.push_back(0);
+        m_paletteIndex.emplace(hash, info.paletteId);
+    }
+    ++m_paletteUses[info.paletteId];
+    m_frames.push_back(info);
+}
+
+GIFEnc::PalettePlanner::Plan
+GIFEnc::PalettePlanner::plan() const noexcept {
+    Plan best;
+    if (m_frames.empty()) {
+        return best;
+    }
+
+    size_t localTotal = 0;
+    for (const auto& frame : m_frames) {
+        localTotal += 3 * (1ull << frame.minCodeLength) + getFrameDataSize(frame.codeCount, frame.minCodeLength);
+    }
+
+    vector<size_t> candidates(m_palettes.size());
+    std::iota(candidates.begin(), candidates.end(), 0);
+    std::stable_sort(candidates.begin(), candidates.end(), [this](size_t a, size_t b) {
+        return m_paletteUses[a] > m_paletteUses[b];
+    });
+    if (candidates.size() > MAX_CANDIDATES) {
+        candidates.resize(MAX_CANDIDATES);
+    }
+
+    size_t bestTotal = localTotal;
+    for (const auto id : candidates) {
+        const uint32_t mcl = getMinCodeLength(m_palettes[id].size());
+        if (m_hasTransparency && m_transparentIndex >= (1u << mcl)) {
+            continue;
+        }
+        // padded to the full table size to keep it valid
+        vector<PixelBGRA> table = m_palettes[id];
+        table.resize(1u << mcl, makeBGRA(0, 0, 0));
+        const auto lookup = makeColorLookup(table, m_hasTransparency, m_transparentIndex);
+
+        size_t total  = 3 * table.size();
+        size_t shared = 0;
+        for (const auto& frame : m_frames) {
+            const size_t local = 3 * (1ull << frame.minCodeLength) + getFrameDataSize(frame.codeCount, frame.minCodeLength);
+            if (frame.paletteId == id ||
+                mapToPalette(m_palettes[frame.paletteId], frame.used, lookup, m_hasTransparency, m_transparentIndex)) {
+                const size_t global = getFrameDataSize(frame.codeCount, mcl);
+                if (global <= local) {
+                    total += global;
+                    ++shared;
+                    continue;
+                }
+            }
+            total += local;
+        }
+        if (total < bestTotal) {
+            bestTotal              = total;
+            best.globalColorTable  = std::move(table);
+            best.minCodeLength     = mcl;
+            best.sharedFrames      = shared;
+            best.estimatedSaving   = localTotal - total;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,184 @@
+#ifndef GIF_MIRAGE_BUFFER_POOL_H
+#define GIF_MIRAGE_BUFFER_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace GIFImage {
+
+/**
+ * @brief Buffers of the same sizes over and over, frames most of all, recycled instead of allocated.
+ *
+ * Allocating a large buffer maps fresh pages, which fault in one by one on first write,
+ * so a buffer given back is kept, by size, for the next request of that size.
+ * The pool is thread-safe, a buffer can be given back by another thread than the one that took it.
+ */
+template <typename T>
+class BufferPool {
+  public:
+    static constexpr size_t DEFAULT_CAPACITY = 128u << 20;  // bytes of idle buffers kept
+
+    /**
+     * @brief A buffer given back to its pool when the handle goes out of scope.
+     */
+    class Handle {
+      public:
+        Handle() noexcept = default;
+
+        Handle(BufferPool& pool, std::vector<T>&& buffer) noexcept
+            : m_pool(&pool), m_buffer(std::move(buffer)) {}
+
+        Handle(Handle&& other) noexcept
+            : m_pool(other.m_pool), m_buffer(std::move(other.m_buffer)) {
+            other.m_buffer.clear();
+        }
+
+        Handle&
+        operator=(Handle&& other) noexcept {
+            if (this != &other) {
+                reset();
+                m_pool   = other.m_pool;
+                m_buffer = std::move(other.m_buffer);
+                other.m_buffer.clear();
+            }
+            return *this;
+        }
+
+        Handle(const Handle&) = delete;
+
+        Handle&
+        operator=(const Handle&) = delete;
+
+        ~Handle() noexcept {
+            reset();
+        }
+
+        /**
+         * @brief Give the buffer back now, the handle is left empty.
+         */
+        void
+        reset() noexcept {
+            if (m_pool) {
+                m_pool->recycle(std::move(m_buffer));
+            }
+            m_buffer = {};
+        }
+
+        /**
+         * @brief Take the buffer out of the handle, it is not given back then.
+         */
+        [[nodiscard]] std::vector<T>
+        release() noexcept {
+            return std::exchange(m_buffer, {});
+        }
+
+        [[nodiscard]] std::vector<T>&
+        operator*() noexcept {
+            return m_buffer;
+        }
+
+        [[nodiscard]] const std::vector<T>&
+        operator*() const noexcept {
+            return m_buffer;
+        }
+
+        [[nodiscard]] std::vector<T>*
+        operator->() noexcept {
+            return &m_buffer;
+        }
+
+        [[nodiscard]] const std::vector<T>*
+        operator->() const noexcept {
+            return &m_buffer;
+        }
+
+      private:
+        BufferPool* m_pool = nullptr;
+        std::vector<T> m_buffer;
+    };
+
+    explicit BufferPool(const size_t capacity = DEFAULT_CAPACITY) noexcept
+        : m_capacity(capacity) {}
+
+    /**
+     * @brief The pool shared by the whole program for buffers of T.
+     */
+    static BufferPool&
+    global() noexcept {
+        static BufferPool pool;
+        return pool;
+    }
+
+    /**
+     * @brief Get a buffer of exactly @p size elements.
+     *        A recycled buffer keeps what it held before, a new one is value-initialized.
+     */
+    [[nodiscard]] std::vector<T>
+    take(const size_t size) {
+        {
+            std::lock_guard lock(m_mutex);
+            const auto it = m_free.find(size);
+            if (it != m_free.end() && !it->second.empty()) {
+                std::vector<T> buffer = std::move(it->second.back());
+                it->second.pop_back();
+                m_idleBytes -= buffer.capacity() * sizeof(T);
+                return buffer;
+            }
+        }
+        return std::vector<T>(size);
+    }
+
+    /**
+     * @brief Like take, with the buffer given back once the handle is gone.
+     */
+    [[nodiscard]] Handle
+    acquire(const size_t size) {
+        return Handle(*this, take(size));
+    }
+
+    /**
+     * @brief Wrap a buffer from elsewhere, a frame returned by value say, to give it back once the handle is gone.
+     */
+    [[nodiscard]] Handle
+    adopt(std::vector<T>&& buffer) noexcept {
+        return Handle(*this, std::move(buffer));
+    }
+
+    /**
+     * @brief Give a buffer back for a later take of its size.
+     *        It is freed instead if the pool holds too much already.
+     */
+    void
+    recycle(std::vector<T>&& buffer) noexcept {
+        const size_t bytes = buffer.capacity() * sizeof(T);
+        if (buffer.empty() || bytes > m_capacity) {
+            return;
+        }
+        std::vector<T> dropped;  // freed outside the lock
+        std::lock_guard lock(m_mutex);
+        if (m_idleBytes + bytes > m_capacity) {
+            dropped = std::move(buffer);
+            return;
+        }
+        try {
+            m_free[buffer.size()].push_back(std::move(buffer));
+            m_idleBytes += bytes;
+        } catch (...) {
+            dropped = std::move(buffer);
+        }
+    }
+
+  private:
+    std::mutex m_mutex;  // guards the buffers below
+    const size_t m_capacity;
+    size_t m_idleBytes = 0;
+    std::unordered_map<size_t, std::vector<std::vector<T>>> m_free;  // idle buffers by size
+};
+
+}  // namespace GIFImage
+
+#endif  // GIF_MIRAGE_BUFFER_POOL_H
@@ -1,41 +1,169 @@
 #ifndef IMAGE_SEQUENCE_DITHER_H
 #define IMAGE_SEQUENCE_DITHER_H
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <vector>
 
 #include "def.h"
 
+#if defined(__AVX2__)
+#define IMSQ_DITHER_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMSQ_DITHER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define IMSQ_DITHER_NEON
+#include <arm_neon.h>
+#endif
+
 
 namespace ImageSequence::Dither {
 
 template <uint8_t size>
 class BayerOrderedDithering {
+    static_assert(size == 2 || size == 4 || size == 8 || size == 16, "Bayer matrix size must be 2, 4, 8 or 16");
+
   public:
+    static constexpr uint32_t ROW_SPAN = 32;  // columns per threshold row, a multiple of every size
+
+    // rank of each cell, indexed [x][y], built recursively from the 2x2 matrix
+    // e.g. {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}} for size 4
+    static constexpr auto BAYER_MATRIX = []() {
+        std::array<std::array<uint8_t, size>, size> ret{};
+        for (uint32_t n = 1; n < size; n *= 2) {
+            for (uint32_t x = 0; x < n; ++x) {
+                for (uint32_t y = 0; y < n; ++y) {
+                    const auto v      = static_cast<uint8_t>(4 * ret[x][y]);
+                    ret[x][y]         = v;
+                    ret[x][y + n]     = static_cast<uint8_t>(v + 2);
+                    ret[x + n][y]     = static_cast<uint8_t>(v + 3);
+                    ret[x + n][y + n] = static_cast<uint8_t>(v + 1);
+                }
+            }
+        }
+        return ret;
+    }();
+
+    // THRESHOLDS[y][x] = floor(rank * 255 / size²), repeated over ROW_SPAN columns.
+    // for an integer l, l > floor(t) exactly when l > t, so this matches the real valued matrix.
+    static constexpr auto THRESHOLDS = []() {
+        std::array<std::array<uint8_t, ROW_SPAN>, size> ret{};
+        for (uint32_t y = 0; y < size; ++y) {
+            for (uint32_t x = 0; x < ROW_SPAN; ++x) {
+                ret[y][x] = static_cast<uint8_t>(BAYER_MATRIX[x % size][y] * 255u / (size * size));
+            }
+        }
+        return ret;
+    }();
+
+    /**
+     * @brief Dither row @p y of a luma plane to 255 or 0 per pixel.
+     *        @p out may alias @p luma.
+     */
+    static void
+    ditherRow(uint8_t* out, const uint8_t* luma, const uint32_t width, const uint32_t y) noexcept {
+        const uint8_t* thresholds = THRESHOLDS[y % size].data();
+        uint32_t x                = 0;
+#if defined(IMSQ_DITHER_AVX2)
+        // no unsigned compare, flip the sign bit of both sides instead
+        const __m256i bias = _mm256_set1_epi8(static_cast<char>(0x80));
+        const __m256i t    = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(thresholds)), bias);
+        for (; x + 32 <= width; x += 32) {
+            const __m256i l = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(luma + x)), bias);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_cmpgt_epi8(l, t));
+        }
+#elif defined(IMSQ_DITHER_SSE2)
+        const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+        const __m128i t    = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(thresholds)), bias);
+        for (; x + 16 <= width; x += 16) {
+            const __m128i l = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(luma + x)), bias);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_cmpgt_epi8(l, t));
+        }
+#elif defined(IMSQ_DITHER_NEON)
+        const uint8x16_t t = vld1q_u8(thresholds);
+        for (; x + 16 <= width; x += 16) {
+            vst1q_u8(out + x, vcgtq_u8(vld1q_u8(luma + x), t));
+        }
+#endif
+        for (; x < width; ++x) {
+            out[x] = luma[x] > thresholds[x % size] ? 255 : 0;
+        }
+    }
+
+    /**
+     * @brief Dither row @p y of a luma plane to one bit per pixel, lowest bit first,
+     *        set for the pixels that would become 255.
+     *        Writes (width + 63) / 64 words, the bits past @p width are cleared.
+     */
     static void
-    orderedDithering(uint8_t* out, const uint8_t* in, uint32_t width, uint32_t height) {
-        // do nothing
+    ditherRowBits(uint64_t* out, const uint8_t* luma, const uint32_t width, const uint32_t y) noexcept {
+        const uint8_t* thresholds = THRESHOLDS[y % size].data();
+#if defined(IMSQ_DITHER_AVX2)
+        const __m256i bias = _mm256_set1_epi8(static_cast<char>(0x80));
+        const __m256i t    = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(thresholds)), bias);
+#elif defined(IMSQ_DITHER_SSE2)
+        const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+        const __m128i t    = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(thresholds)), bias);
+#elif defined(IMSQ_DITHER_NEON)
+        const uint8x16_t t       = vld1q_u8(thresholds);
+        static const uint8_t W[] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        const uint8x16_t weights = vld1q_u8(W);
+#endif
+        for (uint32_t x = 0; x < width; x += 64) {
+            const uint8_t* p = luma + x;
+            const uint32_t n = std::min<uint32_t>(64, width - x);
+            uint64_t word    = 0;
+            uint32_t k       = 0;
+#if defined(IMSQ_DITHER_AVX2)
+            for (; k + 32 <= n; k += 32) {
+                const __m256i l = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + k)), bias);
+                word |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(l, t)))) << k;
+            }
+#elif defined(IMSQ_DITHER_SSE2)
+            for (; k + 16 <= n; k += 16) {
+                const __m128i l = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + k)), bias);
+                word |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(l, t)))) << k;
+            }
+#elif defined(IMSQ_DITHER_NEON)
+            for (; k + 16 <= n; k += 16) {
+                // weight each lane by its bit, then add up each half
+                uint8x16_t bits = vandq_u8(vcgtq_u8(vld1q_u8(p + k), t), weights);
+                bits            = vpaddq_u8(bits, bits);
+                bits            = vpaddq_u8(bits, bits);
+                bits            = vpaddq_u8(bits, bits);
+                word |= static_cast<uint64_t>(vgetq_lane_u16(vreinterpretq_u16_u8(bits), 0)) << k;
+            }
+#endif
+            for (; k < n; ++k) {
+                word |= static_cast<uint64_t>(p[k] > thresholds[k % size]) << k;
+            }
+            *out++ = word;
+        }
     }
-};
 
-template <>
-class BayerOrderedDithering<4> {
-  private:
-    // {{{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}}}
-    static constexpr std::array<std::array<double, 4>, 4> BAYER_MATRIX{{{0, 127.5, 31.875, 159.375},
-                                                                        {191.25, 63.75, 223.125, 95.625},
-                                                                        {47.8125, 175.3125, 15.9375, 143.4375},
-                                                                        {239.0625, 111.5625, 207.1875, 79.6875}}};
+    /**
+     * @brief Dither a plane of luma values, @p out may alias @p luma.
+     */
+    static void
+    orderedDithering(uint8_t* out, const uint8_t* luma, uint32_t width, uint32_t height) noexcept {
+        for (uint32_t y = 0; y < height; y++) {
+            const size_t offset = static_cast<size_t>(y) * width;
+            ditherRow(out + offset, luma + offset, width, y);
+        }
+    }
 
-  public:
     static void
     orderedDithering(uint8_t* out, const PixelBGRA* data, uint32_t width, uint32_t height) noexcept {
-        const auto argb = data;
-        for (uint32_t y = 0, idx = 0; y < height; y++) {
-            for (uint32_t x = 0; x < width; x++, idx++) {
-                const auto v = *(argb + idx);
-                const auto l = toGray(v).r;
-                out[idx]     = double(l) > (BAYER_MATRIX[x & 3][y & 3]) ? 255 : 0;
+        std::vector<uint8_t> luma(width);
+        for (uint32_t y = 0; y < height; y++) {
+            const size_t offset = static_cast<size_t>(y) * width;
+            for (uint32_t x = 0; x < width; x++) {
+                luma[x] = toGray(data[offset + x]).r;
             }
+            ditherRow(out + offset, luma.data(), width, y);
         }
     }
 };
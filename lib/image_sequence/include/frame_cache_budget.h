@@ -0,0 +1,126 @@
+#ifndef GIF_MIRAGE_FRAME_CACHE_BUDGET_H
+#define GIF_MIRAGE_FRAME_CACHE_BUDGET_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+
+namespace GIFImage {
+
+/**
+ * @brief A budget for decoded frames shared by several sequences, their caches together stay within it.
+ *
+ * Over budget, frames are dropped from the caches that were used the longest time ago first,
+ * so sequences no longer read give their memory to the ones still being read.
+ * Each cache keeps at least its newest frame.
+ */
+class FrameCacheBudget {
+  public:
+    /**
+     * @brief A cache charged to the budget, attached for as long as it holds frames.
+     */
+    class Client {
+      public:
+        virtual ~Client() = default;
+
+        /**
+         * @brief Drop the least recently used frame unless it is the only one left.
+         * @return the bytes freed, 0 if nothing was dropped.
+         * @note Called with the budget locked, must not call back into the budget other than remove.
+         */
+        virtual size_t
+        evictOldest() noexcept = 0;
+
+      private:
+        friend class FrameCacheBudget;
+
+        std::atomic<uint64_t> m_lastUse = 0;
+    };
+
+    explicit FrameCacheBudget(const size_t capacity) noexcept
+        : m_capacity(capacity) {}
+
+    void
+    attach(Client& client) {
+        touch(client);
+        std::lock_guard lock(m_mutex);
+        m_clients.push_back(&client);
+    }
+
+    /**
+     * @brief Stop evicting from the client, it is not called anymore once this returns.
+     *        The bytes it still holds have to be removed separately.
+     */
+    void
+    detach(Client& client) noexcept {
+        std::lock_guard lock(m_mutex);
+        std::erase(m_clients, &client);
+    }
+
+    // mark the client as used, without locking
+    void
+    touch(Client& client) noexcept {
+        client.m_lastUse.store(m_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void
+    add(const size_t bytes) noexcept {
+        m_used.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void
+    remove(const size_t bytes) noexcept {
+        m_used.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool
+    isExceeded() const noexcept {
+        return m_used.load(std::memory_order_relaxed) > m_capacity;
+    }
+
+    /**
+     * @brief Evict frames, least recently used clients first, until the budget is met.
+     * @note The caller must not hold the lock of its own cache.
+     */
+    void
+    reclaim() noexcept {
+        if (!isExceeded()) {
+            return;
+        }
+        std::lock_guard lock(m_mutex);
+        std::vector<std::pair<uint64_t, Client*>> order;
+        try {
+            order.reserve(m_clients.size());
+        } catch (...) {
+            return;
+        }
+        for (auto* client : m_clients) {
+            order.emplace_back(client->m_lastUse.load(std::memory_order_relaxed), client);
+        }
+        std::sort(order.begin(), order.end());
+        for (const auto& [lastUse, client] : order) {
+            while (isExceeded()) {
+                if (client->evictOldest() == 0) break;
+            }
+            if (!isExceeded()) {
+                return;
+            }
+        }
+    }
+
+  private:
+    const size_t m_capacity;
+    std::atomic<size_t> m_used    = 0;
+    std::atomic<uint64_t> m_clock = 0;  // increases with every use of any client
+    std::mutex m_mutex;                 // guards the clients below
+    std::vector<Client*> m_clients;
+};
+
+}  // namespace GIFImage
+
+#endif  // GIF_MIRAGE_FRAME_CACHE_BUDGET_H
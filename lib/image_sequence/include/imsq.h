@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "def.h"
+#include "imsq_options.h"
 
 
 namespace GIFImage {
@@ -14,6 +15,20 @@ namespace GIFImage {
 // Forward declaration
 class ImageSequence;
 
+/**
+ * @brief Read-only pixels of a frame at its original size, borrowed instead of copied.
+ *        The pixels stay valid as long as a copy of the view, or of its owner, is alive.
+ */
+struct FrameView {
+    std::span<const PixelBGRA> pixels;
+    std::shared_ptr<const void> owner;  // keeps the pixels alive, null if the caller of borrow does
+
+    [[nodiscard]] bool
+    empty() const noexcept {
+        return pixels.empty();
+    }
+};
+
 class ImageSequence {
   public:
     using Ref = std::unique_ptr<ImageSequence>;
@@ -24,7 +39,7 @@ class ImageSequence {
     static constexpr uint32_t DEFAULT_DELAY = 40;  // Default delay in milliseconds
 
     static Ref
-    read(const std::string& filename) noexcept;
+    read(const std::string& filename, const ReadOptions& options = {}) noexcept;
 
     static Ref
     load(const std::span<const std::span<const PixelBGRA>>& frames,
@@ -32,6 +47,28 @@ class ImageSequence {
          uint32_t width,
          uint32_t height) noexcept;
 
+    /**
+     * @brief Like load, taking over the frames instead of copying them.
+     */
+    static Ref
+    load(std::vector<std::vector<PixelBGRA>>&& frames,
+         const std::span<const uint32_t>& delays,
+         uint32_t width,
+         uint32_t height) noexcept;
+
+    /**
+     * @brief Like load, reading the frames where they are instead of copying them.
+     *
+     * @param[in] owner Kept alive as long as the sequence or a view of its frames is, and
+     *                  expected to keep @p frames valid meanwhile. If null, the caller does.
+     */
+    static Ref
+    borrow(const std::span<const std::span<const PixelBGRA>>& frames,
+           const std::span<const uint32_t>& delays,
+           uint32_t width,
+           uint32_t height,
+           std::shared_ptr<const void> owner = nullptr) noexcept;
+
     static std::vector<PixelBGRA>
     parseBase64(const std::string& base64) noexcept;
 
@@ -86,6 +123,54 @@ class ImageSequence {
                    uint32_t width,
                    uint32_t height) noexcept = 0;
 
+    /**
+     * @brief Get the frame of the specified index at its original size without copying it,
+     *        for backends holding it in BGRA already. The default implementation wraps
+     *        the result of getFrameBuffer, which costs a conversion but no further copy.
+     *
+     * @return The view of the frame, empty on failure.
+     */
+    [[nodiscard]] virtual FrameView
+    getFrameView(uint32_t index) noexcept;
+
+    /**
+     * @brief Get the luma of the frame of the specified index, one byte per pixel,
+     *        computed the same way as toGray and resized like getFrameBuffer.
+     *        The default implementation converts the result of getFrameBuffer,
+     *        backends may override it to skip the BGRA buffer altogether.
+     *
+     * @return The luma plane of the frame, empty on failure.
+     */
+    [[nodiscard]] virtual std::vector<uint8_t>
+    getFrameLuma(uint32_t index,
+                 uint32_t width,
+                 uint32_t height) noexcept;
+
+    /**
+     * @brief Whether the frame of the specified index is pixel for pixel the same as
+     *        the one before it, so anything derived from that one can be reused.
+     *        The default implementation does not compare and returns false.
+     */
+    [[nodiscard]] virtual bool
+    isSameAsPrevious(uint32_t index) noexcept;
+
+    /**
+     * @brief Announce the frames that are going to be read, so that backends decoding on demand
+     *        can skip the others, apart from what the announced ones depend on.
+     *        Announcements add up, other frames can still be read, at a higher cost.
+     *        The default implementation ignores them.
+     */
+    virtual void
+    requestFrames(const std::span<const uint32_t>& indices) noexcept;
+
+    /**
+     * @brief Close what backends decoding on demand keep open between reads, such as the decoder and its threads.
+     *        It is opened again by the next read of a frame that is not cached.
+     *        The default implementation does nothing.
+     */
+    virtual void
+    releaseDecoder() noexcept;
+
     [[nodiscard]] virtual uint32_t
     getFrameCount() const noexcept = 0;
 
@@ -0,0 +1,26 @@
+#ifndef GIF_MIRAGE_IMAGE_SEQUENCE_OPTIONS_H
+#define GIF_MIRAGE_IMAGE_SEQUENCE_OPTIONS_H
+
+#include <cstdint>
+#include <memory>
+
+#include "frame_cache_budget.h"
+
+
+namespace GIFImage {
+
+struct ReadOptions {
+    static constexpr uint32_t DEFAULT_MAX_FRAME_CACHE_MB = 256;
+
+    // budget for decoded frames kept in memory by backends decoding on demand, per sequence.
+    // 0 means unlimited.
+    uint32_t maxFrameCacheMB = DEFAULT_MAX_FRAME_CACHE_MB;
+    // replaces maxFrameCacheMB if set, for sequences that are open at the same time
+    std::shared_ptr<FrameCacheBudget> sharedFrameCache;
+    // threads of a decoder supporting frame or slice threading, 0 means one per core
+    uint32_t decoderThreads = 0;
+};
+
+}  // namespace GIFImage
+
+#endif  // GIF_MIRAGE_IMAGE_SEQUENCE_OPTIONS_H
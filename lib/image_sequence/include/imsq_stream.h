@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "def.h"
+#include "imsq_options.h"
 
 
 namespace GIFImage {
@@ -28,11 +29,13 @@ class ImageSequenceStream {
   public:
     using Ref = std::unique_ptr<ImageSequenceStream>;
 
+    static constexpr size_t DEFAULT_PREFETCH_FRAMES = 4;
+
     static bool
     initDecoder(const char*) noexcept;
 
     static Ref
-    read(const std::string&) noexcept;
+    read(const std::string& filename, const ReadOptions& options = {}) noexcept;
 
     static Ref
     load(const std::span<const std::span<const PixelBGRA>>& frames,
@@ -40,6 +43,16 @@ class ImageSequenceStream {
          const std::span<const uint32_t> widths,
          const std::span<const uint32_t> heights) noexcept;
 
+    /**
+     * @brief Decode the frames of a stream ahead on a worker thread, so reading overlaps with using them.
+     * @param source Stream to read, any backend.
+     * @param capacity Frames decoded ahead at most, 0 returns the source itself.
+     *
+     * @return The prefetching stream, the source if the worker cannot be started, nullptr for a null source.
+     */
+    static Ref
+    prefetch(Ref source, size_t capacity = DEFAULT_PREFETCH_FRAMES) noexcept;
+
     virtual ~ImageSequenceStream() = default;
 
     virtual Frame::Ref
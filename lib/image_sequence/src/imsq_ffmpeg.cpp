@@ -1,12 +1,21 @@
 #ifdef IMSQ_USE_FFMPEG
 
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_map>
 
 #include "./imsq_webp.cpp"
+#include "buffer_pool.h"
 #include "defer.h"
 #include "imsq.h"
 #include "imsq_exception.h"
 #include "log.h"
+#include "sws_cache.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -15,18 +24,87 @@ extern "C" {
 #include <libavfilter/buffersrc.h>
 #include <libavformat/avformat.h>
 #include <libavutil/base64.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 }
 
 using namespace GIFImage;
 using std::string, std::vector;
 
-class ImageSequenceFFmpegImpl : public ImageSequence {
+struct CropRect {
+    uint32_t x      = 0;
+    uint32_t y      = 0;
+    uint32_t width  = 0;
+    uint32_t height = 0;
+};
+
+// the centered part of a source that stays visible once it is scaled to cover the target
+static CropRect
+getCoverCrop(const uint32_t srcWidth, const uint32_t srcHeight, const uint32_t dstWidth, const uint32_t dstHeight) {
+    CropRect crop{0, 0, srcWidth, srcHeight};
+    if (static_cast<uint64_t>(dstWidth) * srcHeight >= static_cast<uint64_t>(dstHeight) * srcWidth) {
+        // scaled to the target width, top and bottom are cut
+        const uint64_t height = (static_cast<uint64_t>(dstHeight) * srcWidth + dstWidth / 2) / dstWidth;
+        crop.height           = static_cast<uint32_t>(std::clamp<uint64_t>(height, 1, srcHeight));
+    } else {
+        // scaled to the target height, left and right are cut
+        const uint64_t width = (static_cast<uint64_t>(dstWidth) * srcHeight + dstHeight / 2) / dstHeight;
+        crop.width           = static_cast<uint32_t>(std::clamp<uint64_t>(width, 1, srcWidth));
+    }
+    crop.x = (srcWidth - crop.width) / 2;
+    crop.y = (srcHeight - crop.height) / 2;
+    return crop;
+}
+
+// memory held by the buffers of a frame
+static size_t
+getFrameBytes(const AVFrame& frame) {
+    const int size = av_image_get_buffer_size(static_cast<AVPixelFormat>(frame.format), frame.width, frame.height, 1);
+    return size > 0 ? static_cast<size_t>(size) : static_cast<size_t>(frame.width) * frame.height * sizeof(PixelBGRA);
+}
+
+// whether two decoded frames hold the same pixels, plane by plane
+static bool
+isSameImage(const AVFrame& a, const AVFrame& b) {
+    if (a.format != b.format || a.width != b.width || a.height != b.height) {
+        return false;
+    }
+    const auto format              = static_cast<AVPixelFormat>(a.format);
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    int lineSizes[4]{};
+    if (!desc || av_image_fill_linesizes(lineSizes, format, a.width) < 0) {
+        return false;
+    }
+    for (int plane = 0; plane < 4 && lineSizes[plane] > 0; ++plane) {
+        // the chroma planes are subsampled, alpha is not
+        const int rows = plane == 1 || plane == 2 ? AV_CEIL_RSHIFT(a.height, desc->log2_chroma_h) : a.height;
+        for (int y = 0; y < rows; ++y) {
+            if (std::memcmp(a.data[plane] + static_cast<ptrdiff_t>(y) * a.linesize[plane],
+                            b.data[plane] + static_cast<ptrdiff_t>(y) * b.linesize[plane],
+                            lineSizes[plane]) != 0) {
+                return false;
+            }
+        }
+    }
+    if (desc->flags & AV_PIX_FMT_FLAG_PAL) {
+        return std::memcmp(a.data[1], b.data[1], 256 * 4) == 0;
+    }
+    return true;
+}
+
+class ImageSequenceFFmpegImpl : public ImageSequence, private FrameCacheBudget::Client {
   public:
-    explicit ImageSequenceFFmpegImpl(const string& filename);
+    ImageSequenceFFmpegImpl(const string& filename, const ReadOptions& options);
 
-    ~ImageSequenceFFmpegImpl() noexcept override = default;
+    ~ImageSequenceFFmpegImpl() noexcept override {
+        closeDecoder();
+        if (m_sharedCache) {
+            m_sharedCache->detach(*this);
+            m_sharedCache->remove(m_cacheSize);
+        }
+    }
 
     [[nodiscard]] const vector<uint32_t>&
     getDelays() noexcept override {
@@ -38,6 +116,20 @@ class ImageSequenceFFmpegImpl : public ImageSequence {
                    uint32_t width,
                    uint32_t height) noexcept override;
 
+    [[nodiscard]] vector<uint8_t>
+    getFrameLuma(uint32_t index,
+                 uint32_t width,
+                 uint32_t height) noexcept override;
+
+    [[nodiscard]] bool
+    isSameAsPrevious(uint32_t index) noexcept override;
+
+    void
+    requestFrames(const std::span<const uint32_t>& indices) noexcept override;
+
+    void
+    releaseDecoder() noexcept override;
+
     [[nodiscard]] uint32_t
     getFrameCount() const noexcept override {
         return static_cast<uint32_t>(m_delays.size());
@@ -54,10 +146,84 @@ class ImageSequenceFFmpegImpl : public ImageSequence {
     }
 
   private:
+    using Frame      = std::shared_ptr<const AVFrame>;  // as output by the decoder
+    using CacheEntry = std::pair<uint32_t, Frame>;
+
+    // (re)open the input and the decoder, positioned at the first frame
+    void
+    openDecoder();
+
+    void
+    closeDecoder() noexcept;
+
+    // the frame of the specified index, from the cache or decoded on demand
+    Frame
+    getFrame(uint32_t index) noexcept;
+
+    // position the decoder at or before the specified frame, requires m_decoderMutex
+    void
+    seekTo(uint32_t index);
+
+    // decode up to the specified frame, caching the requested ones on the way, requires m_decoderMutex
+    Frame
+    decodeUntil(uint32_t index);
+
+    // whether the frame is the target or one of the requested ones, every frame is without requests.
+    // requires m_decoderMutex
+    [[nodiscard]] bool
+    isWanted(uint32_t frameIndex, uint32_t target) const noexcept;
+
+    // the frame with the specified timestamp, or std::nullopt if there is none
+    [[nodiscard]] std::optional<uint32_t>
+    findFrame(int64_t pts) const noexcept;
+
+    // a reference to the decoded frame, requires m_decoderMutex
+    Frame
+    takeFrame() const;
+
+    // scale the part of a frame visible in "cover" mode into the target buffer in one pass
+    bool
+    scaleCover(const AVFrame& frame,
+               uint32_t width,
+               uint32_t height,
+               AVPixelFormat dstFormat,
+               bool fullRange,
+               uint8_t* dst,
+               int dstLineSize) const noexcept;
+
+    Frame
+    findCached(uint32_t index);
+
+    void
+    addCached(uint32_t index, const Frame& frame);
+
+    size_t
+    evictOldest() noexcept override;
+
+    string m_filename;
     vector<uint32_t> m_delays;
     uint32_t m_width  = 0;
     uint32_t m_height = 0;
-    vector<vector<PixelBGRA>> m_frameBuffer;
+    vector<int64_t> m_pts;         // presentation timestamp of each frame, ascending
+    vector<uint32_t> m_keyFrames;  // frames decoding can start from, ascending, the first is 0
+
+    std::mutex m_decoderMutex;  // guards the decoder state below
+    AVFormatContext* m_formatCtx = nullptr;
+    AVCodecContext* m_codecCtx   = nullptr;
+    AVPacket* m_packet           = nullptr;
+    AVFrame* m_frame             = nullptr;
+    int32_t m_streamIndex        = -1;
+    uint32_t m_nextIndex         = 0;  // frame the decoder outputs next, past the end if unknown
+    uint32_t m_decoderThreads    = 0;  // 0 means one per core
+    vector<bool> m_requested;          // by requestFrames, empty if none
+    vector<bool> m_discarded;          // sent as non-reference since the decoder was positioned, may never be output
+
+    std::mutex m_cacheMutex;     // guards the cache below
+    size_t m_cacheCapacity = 0;  // in bytes, 0 means unlimited
+    size_t m_cacheSize     = 0;
+    std::shared_ptr<FrameCacheBudget> m_sharedCache;  // used instead of the capacity if set, evicts across sequences
+    std::list<CacheEntry> m_cache;  // most recently used first
+    std::unordered_map<uint32_t, std::list<CacheEntry>::iterator> m_cacheIndex;
 };
 
 bool
@@ -66,137 +232,485 @@ ImageSequence::initDecoder(const char*) noexcept {
 }
 
 ImageSequence::Ref
-ImageSequence::read(const string& filename) noexcept {
+ImageSequence::read(const string& filename, const ReadOptions& options) noexcept {
     try {
         if (NaiveIO::getExtName(filename) == ".webp") {
             return std::make_unique<ImageSequenceWebpImpl>(filename);
         }
-        return std::make_unique<ImageSequenceFFmpegImpl>(filename);
+        return std::make_unique<ImageSequenceFFmpegImpl>(filename, options);
     } catch (const std::exception& e) {
         GeneralLogger::error("Error reading image sequence: " + string(e.what()));
         return nullptr;
     }
 }
 
-ImageSequenceFFmpegImpl::ImageSequenceFFmpegImpl(const string& filename) {
-    AVFormatContext* formatCtx = nullptr;
-    AVCodecContext* codecCtx   = nullptr;
-    AVPacket* packet           = nullptr;
-    AVFrame* frame             = nullptr;
+ImageSequenceFFmpegImpl::ImageSequenceFFmpegImpl(const string& filename, const ReadOptions& options)
+    : m_filename(filename),
+      m_decoderThreads(options.decoderThreads),
+      m_cacheCapacity(static_cast<size_t>(options.maxFrameCacheMB) << 20),
+      m_sharedCache(options.sharedFrameCache) {
+    struct PacketInfo {
+        int64_t pts      = 0;
+        int64_t duration = 0;
+        bool isKey       = false;
+    };
 
-    const Defer defer([&]() {
-        if (frame) av_frame_free(&frame);
-        if (packet) av_packet_free(&packet);
-        if (codecCtx) avcodec_free_context(&codecCtx);
-        if (formatCtx) avformat_close_input(&formatCtx);
-    });
+    try {
+        openDecoder();
+
+        const AVStream* stream = m_formatCtx->streams[m_streamIndex];
+        m_width                = stream->codecpar->width;
+        m_height               = stream->codecpar->height;
+        if (m_width == 0 || m_height == 0) {
+            throw ImageParseException("Invalid frame size.");
+        }
 
+        // index the packets without decoding them
+        vector<PacketInfo> packets;
+        bool hasTimestamps = true;
+        while (av_read_frame(m_formatCtx, m_packet) >= 0) {
+            if (m_packet->stream_index == m_streamIndex) {
+                PacketInfo info;
+                info.pts      = m_packet->pts != AV_NOPTS_VALUE ? m_packet->pts : m_packet->dts;
+                info.duration = m_packet->duration;
+                info.isKey    = (m_packet->flags & AV_PKT_FLAG_KEY) != 0;
+                if (info.pts == AV_NOPTS_VALUE) {
+                    hasTimestamps = false;
+                    info.pts      = packets.empty() ? 0 : packets.back().pts + 1;
+                }
+                packets.push_back(info);
+            }
+            av_packet_unref(m_packet);
+        }
+        if (packets.empty()) {
+            throw ImageParseException("No frame found.");
+        }
+        // frames come out of the decoder in presentation order
+        std::stable_sort(packets.begin(), packets.end(), [](const PacketInfo& a, const PacketInfo& b) {
+            return a.pts < b.pts;
+        });
+
+        // frames of these formats are drawn over the previous ones, so decoding can only start at the first.
+        // without timestamps the decoded frames can not be told apart after a seek either.
+        const auto codecId = stream->codecpar->codec_id;
+        const bool canSeek = hasTimestamps && codecId != AV_CODEC_ID_GIF && codecId != AV_CODEC_ID_APNG;
+
+        const AVRational timeBase = stream->time_base;
+        for (uint32_t i = 0; i < packets.size(); ++i) {
+            m_pts.push_back(packets[i].pts);
+            // duration in ms
+            if (packets[i].duration > 0) {
+                m_delays.push_back(static_cast<uint32_t>(packets[i].duration * av_q2d(timeBase) * 1000));
+            } else {
+                m_delays.push_back(DEFAULT_DELAY);
+            }
+            if (i == 0 || (canSeek && packets[i].isKey)) {
+                m_keyFrames.push_back(i);
+            }
+        }
+        // the first request seeks
+        m_nextIndex = getFrameCount();
+        if (m_sharedCache) {
+            m_sharedCache->attach(*this);
+        }
+    } catch (const std::exception& e) {
+        closeDecoder();
+        throw;
+    } catch (...) {
+        closeDecoder();
+        throw ImageParseException("Unknown error");
+    }
+}
+
+void
+ImageSequenceFFmpegImpl::openDecoder() {
+    closeDecoder();
     try {
         // open file
-        if (avformat_open_input(&formatCtx, filename.c_str(), nullptr, nullptr) < 0) {
-            throw ImageParseException("Failed to open file: " + filename);
+        if (avformat_open_input(&m_formatCtx, m_filename.c_str(), nullptr, nullptr) < 0) {
+            throw ImageParseException("Failed to open file: " + m_filename);
         }
         // find stream
-        if (avformat_find_stream_info(formatCtx, nullptr) < 0) {
+        if (avformat_find_stream_info(m_formatCtx, nullptr) < 0) {
             throw ImageParseException("Failed to find stream info.");
         }
-        int32_t videoStreamIndex = -1;
-        for (uint32_t i = 0; i < formatCtx->nb_streams; i++) {
-            if (formatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-                videoStreamIndex = static_cast<int32_t>(i);
+        m_streamIndex = -1;
+        for (uint32_t i = 0; i < m_formatCtx->nb_streams; i++) {
+            if (m_formatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+                m_streamIndex = static_cast<int32_t>(i);
                 break;
             }
         }
-        if (videoStreamIndex == -1) {
+        if (m_streamIndex == -1) {
             throw ImageParseException("No stream found.");
         }
         // get decoder
-        AVCodecParameters* codecParams = formatCtx->streams[videoStreamIndex]->codecpar;
+        AVCodecParameters* codecParams = m_formatCtx->streams[m_streamIndex]->codecpar;
         const AVCodec* codec           = avcodec_find_decoder(codecParams->codec_id);
         if (!codec) {
             throw ImageParseException("No decoder found.");
         }
-        codecCtx = avcodec_alloc_context3(codec);
-        if (!codecCtx) {
+        m_codecCtx = avcodec_alloc_context3(codec);
+        if (!m_codecCtx) {
             throw ImageParseException("Failed to allocate decoder context.");
         }
-        avcodec_parameters_to_context(codecCtx, codecParams);
+        avcodec_parameters_to_context(m_codecCtx, codecParams);
+        // frames still come out in presentation order, only later
+        m_codecCtx->thread_count = static_cast<int>(m_decoderThreads);
+        m_codecCtx->thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
 
-        if (avcodec_open2(codecCtx, codec, nullptr) < 0) {
+        if (avcodec_open2(m_codecCtx, codec, nullptr) < 0) {
             throw ImageParseException("Failed to open decoder.");
         }
 
-        packet = av_packet_alloc();
-        frame  = av_frame_alloc();
+        m_packet = av_packet_alloc();
+        m_frame  = av_frame_alloc();
+        if (!m_packet || !m_frame) {
+            throw ImageParseException("Failed to allocate frame.");
+        }
+        m_nextIndex = 0;
+        m_discarded.clear();
+    } catch (...) {
+        closeDecoder();
+        throw;
+    }
+}
 
-        AVRational timeBase = formatCtx->streams[videoStreamIndex]->time_base;
-        while (av_read_frame(formatCtx, packet) >= 0) {
-            if (packet->stream_index == videoStreamIndex) {
-                if (avcodec_send_packet(codecCtx, packet) < 0) {
-                    throw ImageParseException("Failed to send packet.");
-                }
-                while (avcodec_receive_frame(codecCtx, frame) >= 0) {
-                    // size of first frame
-                    if (m_width == 0 || m_height == 0) {
-                        m_width  = frame->width;
-                        m_height = frame->height;
-                        if (m_width == 0 || m_height == 0) {
-                            throw ImageParseException("Invalid frame size.");
-                        }
-                    }
+void
+ImageSequenceFFmpegImpl::closeDecoder() noexcept {
+    if (m_frame) av_frame_free(&m_frame);
+    if (m_packet) av_packet_free(&m_packet);
+    if (m_codecCtx) avcodec_free_context(&m_codecCtx);
+    if (m_formatCtx) avformat_close_input(&m_formatCtx);
+}
 
-                    // duration in ms
-                    if (frame->duration > 0) {
-                        uint32_t durationMs = static_cast<uint32_t>(frame->duration * av_q2d(timeBase) * 1000);
-                        m_delays.push_back(durationMs);
-                    } else {
-                        m_delays.push_back(DEFAULT_DELAY);
-                    }
+ImageSequenceFFmpegImpl::Frame
+ImageSequenceFFmpegImpl::getFrame(uint32_t index) noexcept {
+    if (m_delays.empty()) {
+        return nullptr;
+    }
+    index %= getFrameCount();
+    try {
+        if (auto frame = findCached(index)) {
+            return frame;
+        }
+        std::lock_guard<std::mutex> lock(m_decoderMutex);
+        // decoded by another thread meanwhile
+        if (auto frame = findCached(index)) {
+            return frame;
+        }
+        if (auto frame = decodeUntil(index)) {
+            return frame;
+        }
+        throw ImageParseException("Failed to decode frame " + std::to_string(index));
+    } catch (const std::exception& e) {
+        GeneralLogger::error("Error reading frame: " + string(e.what()));
+    } catch (...) {
+        GeneralLogger::error("Unknown error reading frame.");
+    }
+    return nullptr;
+}
 
-                    // Convert frame to BGRA8888
-                    SwsContext* swsCtx = sws_getContext(
-                        frame->width,
-                        frame->height,
-                        static_cast<AVPixelFormat>(frame->format),
-                        m_width,
-                        m_height,
-                        AV_PIX_FMT_BGRA,
-                        SWS_BICUBIC,
-                        nullptr,
-                        nullptr,
-                        nullptr);
-                    if (!swsCtx) {
-                        throw ImageParseException("Failed to create scaling context.");
-                    }
-                    vector<PixelBGRA> frameBuffer(m_width * m_height);
-                    uint8_t* dstData[1]    = {reinterpret_cast<uint8_t*>(frameBuffer.data())};
-                    int32_t dstLineSize[1] = {static_cast<int>(m_width * 4)};
-                    sws_scale(
-                        swsCtx,
-                        frame->data,
-                        frame->linesize,
-                        0,
-                        frame->height,
-                        dstData,
-                        dstLineSize);
-                    sws_freeContext(swsCtx);
-                    // resize if size mismatch
-                    if (m_width != frame->width || m_height != frame->height) {
-                        GeneralLogger::warn("Frame size not consistant, resizing to fit.");
-                        // already resized
-                    }
-                    m_frameBuffer.push_back(std::move(frameBuffer));
+void
+ImageSequenceFFmpegImpl::seekTo(const uint32_t index) {
+    // last key frame at or before the target
+    const uint32_t key = *(std::upper_bound(m_keyFrames.begin(), m_keyFrames.end(), index) - 1);
+    // a packet read ahead for an earlier target may have dropped this frame already
+    const bool discarded = index < m_discarded.size() && m_discarded[index];
+    if (m_formatCtx && !discarded && m_nextIndex >= key && m_nextIndex <= index) {
+        return;  // decoding on is no slower than seeking
+    }
+    if (m_formatCtx && av_seek_frame(m_formatCtx, m_streamIndex, m_pts[key], AVSEEK_FLAG_BACKWARD) >= 0) {
+        avcodec_flush_buffers(m_codecCtx);
+        m_nextIndex = key;
+        m_discarded.clear();
+        return;
+    }
+    // not seekable, start over
+    openDecoder();
+}
+
+ImageSequenceFFmpegImpl::Frame
+ImageSequenceFFmpegImpl::decodeUntil(const uint32_t index) {
+    seekTo(index);
+
+    Frame previous;  // last frame before the target, returned if the decoder fails on the target
+    bool restarted = false;
+    while (true) {
+        const int ret = avcodec_receive_frame(m_codecCtx, m_frame);
+        if (ret == AVERROR(EAGAIN)) {
+            if (av_read_frame(m_formatCtx, m_packet) < 0) {
+                // end of input, flush the frames buffered in the decoder
+                avcodec_send_packet(m_codecCtx, nullptr);
+                continue;
+            }
+            if (m_packet->stream_index == m_streamIndex) {
+                // frames nobody asked for are only decoded if others refer to them
+                const int64_t pts      = m_packet->pts != AV_NOPTS_VALUE ? m_packet->pts : m_packet->dts;
+                const auto frameIndex  = findFrame(pts);
+                m_codecCtx->skip_frame = !frameIndex || isWanted(*frameIndex, index) ? AVDISCARD_DEFAULT
+                                                                                     : AVDISCARD_NONREF;
+                if (m_codecCtx->skip_frame == AVDISCARD_NONREF) {
+                    m_discarded.resize(getFrameCount(), false);
+                    m_discarded[*frameIndex] = true;
                 }
+                // a broken packet only loses its own frame
+                avcodec_send_packet(m_codecCtx, m_packet);
             }
-            av_packet_unref(packet);
+            av_packet_unref(m_packet);
+            continue;
+        }
+        if (ret < 0) {
+            // end of stream or decoder error, the next request seeks
+            m_nextIndex = getFrameCount();
+            break;
+        }
+
+        // match the frame by its timestamp, count from the last one otherwise
+        const int64_t pts         = m_frame->best_effort_timestamp != AV_NOPTS_VALUE ? m_frame->best_effort_timestamp
+                                                                                     : m_frame->pts;
+        const uint32_t frameIndex = findFrame(pts).value_or(m_nextIndex);
+        m_nextIndex               = frameIndex + 1;
+
+        if (frameIndex > index && !previous && !restarted) {
+            // the seek went past the target, decode from the start instead
+            openDecoder();
+            restarted = true;
+            continue;
+        }
+        const auto frame = takeFrame();
+        if (isWanted(frameIndex, index)) {
+            addCached(frameIndex, frame);
+        }
+        if (frameIndex == index) {
+            return frame;
+        }
+        if (frameIndex > index) {
+            break;
+        }
+        previous = frame;
+    }
+    // not cached, the next request for the target tries again
+    return previous;
+}
+
+bool
+ImageSequenceFFmpegImpl::isWanted(const uint32_t frameIndex, const uint32_t target) const noexcept {
+    return frameIndex == target || m_requested.empty() || (frameIndex < m_requested.size() && m_requested[frameIndex]);
+}
+
+std::optional<uint32_t>
+ImageSequenceFFmpegImpl::findFrame(const int64_t pts) const noexcept {
+    if (pts == AV_NOPTS_VALUE) {
+        return std::nullopt;
+    }
+    const auto it = std::lower_bound(m_pts.begin(), m_pts.end(), pts);
+    if (it == m_pts.end() || *it != pts) {
+        return std::nullopt;
+    }
+    return static_cast<uint32_t>(it - m_pts.begin());
+}
+
+void
+ImageSequenceFFmpegImpl::requestFrames(const std::span<const uint32_t>& indices) noexcept {
+    if (m_delays.empty()) return;
+    try {
+        std::lock_guard<std::mutex> lock(m_decoderMutex);
+        m_requested.resize(getFrameCount(), false);
+        for (const auto index : indices) {
+            m_requested[index % getFrameCount()] = true;
         }
     } catch (const std::exception& e) {
-        throw;
-    } catch (...) {
-        throw ImageParseException("Unknown error");
+        GeneralLogger::error("Error requesting frames: " + string(e.what()));
     }
 }
 
+void
+ImageSequenceFFmpegImpl::releaseDecoder() noexcept {
+    std::lock_guard<std::mutex> lock(m_decoderMutex);
+    closeDecoder();
+    // the next request reopens it, see seekTo
+    m_nextIndex = getFrameCount();
+}
+
+ImageSequenceFFmpegImpl::Frame
+ImageSequenceFFmpegImpl::takeFrame() const {
+    AVFrame* frame                 = nullptr;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(m_frame->format));
+    if (desc && (desc->flags & AV_PIX_FMT_FLAG_BITSTREAM)) {
+        // several pixels per byte can not be cropped at any column, these are kept as gray8
+        SwsContext* swsCtx = SwsContextCache::get(
+            m_frame->width,
+            m_frame->height,
+            static_cast<AVPixelFormat>(m_frame->format),
+            m_frame->width,
+            m_frame->height,
+            AV_PIX_FMT_GRAY8,
+            SWS_POINT);
+        frame = av_frame_alloc();
+        if (!swsCtx || !frame) {
+            av_frame_free(&frame);
+            throw ImageParseException("Failed to convert frame.");
+        }
+        frame->format = AV_PIX_FMT_GRAY8;
+        frame->width  = m_frame->width;
+        frame->height = m_frame->height;
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            av_frame_free(&frame);
+            throw ImageParseException("Failed to allocate frame buffer.");
+        }
+        sws_scale(swsCtx, m_frame->data, m_frame->linesize, 0, m_frame->height, frame->data, frame->linesize);
+    } else {
+        // shares the buffers of the decoder, which allocates new ones rather than writing to referenced ones
+        frame = av_frame_clone(m_frame);
+        if (!frame) {
+            throw ImageParseException("Failed to reference frame.");
+        }
+    }
+    return {frame, [](const AVFrame* ref) {
+                auto* toFree = const_cast<AVFrame*>(ref);
+                av_frame_free(&toFree);
+            }};
+}
+
+bool
+ImageSequenceFFmpegImpl::scaleCover(const AVFrame& frame,
+                                    const uint32_t width,
+                                    const uint32_t height,
+                                    const AVPixelFormat dstFormat,
+                                    const bool fullRange,
+                                    uint8_t* dst,
+                                    const int dstLineSize) const noexcept {
+    const auto format              = static_cast<AVPixelFormat>(frame.format);
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL))) {
+        GeneralLogger::error("Unsupported pixel format: " + std::to_string(frame.format));
+        return false;
+    }
+    AVFrame* cropped = av_frame_clone(&frame);
+    if (!cropped) {
+        GeneralLogger::error("Failed to reference frame");
+        return false;
+    }
+    const Defer defer([&]() { av_frame_free(&cropped); });
+
+    // the crop is taken at the sequence size, frames of another size are scaled to fit
+    const auto crop = getCoverCrop(m_width, m_height, width, height);
+    if (crop.width != m_width || crop.height != m_height) {
+        const uint64_t frameWidth  = frame.width;
+        const uint64_t frameHeight = frame.height;
+        // keep luma and subsampled chroma in step
+        const uint64_t alignX = ~((1ull << desc->log2_chroma_w) - 1);
+        const uint64_t alignY = ~((1ull << desc->log2_chroma_h) - 1);
+        const uint64_t left   = (crop.x * frameWidth / m_width) & alignX;
+        const uint64_t top    = (crop.y * frameHeight / m_height) & alignY;
+        const uint64_t right  = std::max(left + 1, (static_cast<uint64_t>(crop.x) + crop.width) * frameWidth / m_width);
+        const uint64_t bottom = std::max(top + 1, (static_cast<uint64_t>(crop.y) + crop.height) * frameHeight / m_height);
+
+        cropped->crop_left   = left;
+        cropped->crop_top    = top;
+        cropped->crop_right  = frameWidth - right;
+        cropped->crop_bottom = frameHeight - bottom;
+        if (av_frame_apply_cropping(cropped, AV_FRAME_CROP_UNALIGNED) < 0) {
+            GeneralLogger::error("Failed to crop frame");
+            return false;
+        }
+    }
+
+    // full range output needs the actual range of a YUV source, RGB and gray ones are full range
+    const bool isYUV        = !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->nb_components >= 3;
+    const bool srcFullRange = !isYUV || frame.color_range == AVCOL_RANGE_JPEG || format == AV_PIX_FMT_YUVJ420P ||
+                              format == AV_PIX_FMT_YUVJ422P || format == AV_PIX_FMT_YUVJ444P ||
+                              format == AV_PIX_FMT_YUVJ440P || format == AV_PIX_FMT_YUVJ411P;
+    SwsContext* swsCtx      = SwsContextCache::get(
+        cropped->width,
+        cropped->height,
+        format,
+        static_cast<int>(width),
+        static_cast<int>(height),
+        dstFormat,
+        SWS_BICUBIC,
+        fullRange,
+        srcFullRange);
+    if (!swsCtx) {
+        GeneralLogger::error("Failed to create scaling context");
+        return false;
+    }
+    uint8_t* dstData[1]     = {dst};
+    int32_t dstLineSizes[1] = {dstLineSize};
+    sws_scale(swsCtx, cropped->data, cropped->linesize, 0, cropped->height, dstData, dstLineSizes);
+    return true;
+}
+
+ImageSequenceFFmpegImpl::Frame
+ImageSequenceFFmpegImpl::findCached(const uint32_t index) {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    const auto it = m_cacheIndex.find(index);
+    if (it == m_cacheIndex.end()) {
+        return nullptr;
+    }
+    m_cache.splice(m_cache.begin(), m_cache, it->second);
+    if (m_sharedCache) m_sharedCache->touch(*this);
+    return it->second->second;
+}
+
+void
+ImageSequenceFFmpegImpl::addCached(const uint32_t index, const Frame& frame) {
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        if (m_cacheIndex.contains(index)) {
+            return;
+        }
+        m_cache.emplace_front(index, frame);
+        m_cacheIndex.emplace(index, m_cache.begin());
+        const size_t bytes = getFrameBytes(*frame);
+        m_cacheSize += bytes;
+        if (m_sharedCache) {
+            m_sharedCache->add(bytes);
+        } else {
+            // the newest frame stays even if it alone is over budget
+            while (m_cacheCapacity > 0 && m_cacheSize > m_cacheCapacity && m_cache.size() > 1) {
+                const auto& [oldIndex, oldFrame] = m_cache.back();
+                m_cacheSize -= getFrameBytes(*oldFrame);
+                m_cacheIndex.erase(oldIndex);
+                m_cache.pop_back();
+            }
+        }
+    }
+    if (m_sharedCache) {
+        // may evict from this cache as well, so outside of its lock
+        m_sharedCache->touch(*this);
+        m_sharedCache->reclaim();
+    }
+}
+
+size_t
+ImageSequenceFFmpegImpl::evictOldest() noexcept {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    if (m_cache.size() <= 1) {
+        return 0;
+    }
+    const auto& [oldIndex, oldFrame] = m_cache.back();
+    const size_t bytes               = getFrameBytes(*oldFrame);
+    m_cacheSize -= bytes;
+    m_sharedCache->remove(bytes);
+    m_cacheIndex.erase(oldIndex);
+    m_cache.pop_back();
+    return bytes;
+}
+
+bool
+ImageSequenceFFmpegImpl::isSameAsPrevious(uint32_t index) noexcept {
+    if (m_delays.empty()) return false;
+    index %= getFrameCount();
+    if (index == 0) return false;
+    // in decoding order
+    const auto previous = getFrame(index - 1);
+    const auto frame    = getFrame(index);
+    if (!frame || !previous) return false;
+    return frame == previous || isSameImage(*frame, *previous);
+}
+
 vector<PixelBGRA>
 ImageSequence::resizeCover(const vector<PixelBGRA>& buffer,
                            uint32_t origWidth,
@@ -211,52 +725,30 @@ ImageSequence::resizeCover(const vector<PixelBGRA>& buffer,
         return vector(buffer);  // No resizing needed
     }
 
-    double scaleX = static_cast<double>(targetWidth) / origWidth;
-    double scaleY = static_cast<double>(targetHeight) / origHeight;
-    double scale  = scaleX < scaleY ? scaleY : scaleX;
-
-    uint32_t scaledWidth  = static_cast<uint32_t>(origWidth * scale);
-    uint32_t scaledHeight = static_cast<uint32_t>(origHeight * scale);
-
-    uint32_t cropX = (scaledWidth > targetWidth) ? (scaledWidth - targetWidth) / 2 : 0;
-    uint32_t cropY = (scaledHeight > targetHeight) ? (scaledHeight - targetHeight) / 2 : 0;
-
-    vector<PixelBGRA> output(targetWidth * targetHeight);
-
-    SwsContext* swsCtx = sws_getContext(
-        origWidth,
-        origHeight,
+    // only the part that stays visible is scaled, straight into the output
+    const auto crop    = getCoverCrop(origWidth, origHeight, targetWidth, targetHeight);
+    SwsContext* swsCtx = SwsContextCache::get(
+        static_cast<int>(crop.width),
+        static_cast<int>(crop.height),
         AV_PIX_FMT_BGRA,
-        scaledWidth,
-        scaledHeight,
+        static_cast<int>(targetWidth),
+        static_cast<int>(targetHeight),
         AV_PIX_FMT_BGRA,
-        SWS_BICUBIC,
-        nullptr,
-        nullptr,
-        nullptr);
+        SWS_BICUBIC);
 
     if (!swsCtx) {
         GeneralLogger::error("Failed to create scaling context");
         return {};
     }
 
-    uint8_t* srcData[1] = {reinterpret_cast<uint8_t*>(const_cast<PixelBGRA*>(buffer.data()))};
-    int srcLineSize[1]  = {static_cast<int>(origWidth * sizeof(PixelBGRA))};
-
-    vector<PixelBGRA> scaledBuffer(scaledWidth * scaledHeight);
-    uint8_t* dstData[1] = {reinterpret_cast<uint8_t*>(scaledBuffer.data())};
-    int dstLineSize[1]  = {static_cast<int>(scaledWidth * sizeof(PixelBGRA))};
+    const uint8_t* srcData[1] = {reinterpret_cast<const uint8_t*>(buffer.data() + static_cast<size_t>(crop.y) * origWidth + crop.x)};
+    int srcLineSize[1]        = {static_cast<int>(origWidth * sizeof(PixelBGRA))};
 
-    sws_scale(swsCtx, srcData, srcLineSize, 0, origHeight, dstData, dstLineSize);
+    auto output         = BufferPool<PixelBGRA>::global().take(static_cast<size_t>(targetWidth) * targetHeight);
+    uint8_t* dstData[1] = {reinterpret_cast<uint8_t*>(output.data())};
+    int dstLineSize[1]  = {static_cast<int>(targetWidth * sizeof(PixelBGRA))};
 
-    sws_freeContext(swsCtx);
-
-    for (uint32_t y = 0; y < targetHeight; ++y) {
-        for (uint32_t x = 0; x < targetWidth; ++x) {
-            output[y * targetWidth + x] =
-                scaledBuffer[(y + cropY) * scaledWidth + (x + cropX)];
-        }
-    }
+    sws_scale(swsCtx, srcData, srcLineSize, 0, static_cast<int>(crop.height), dstData, dstLineSize);
 
     return output;
 }
@@ -265,19 +757,44 @@ vector<PixelBGRA>
 ImageSequenceFFmpegImpl::getFrameBuffer(uint32_t index,
                                         uint32_t width,
                                         uint32_t height) noexcept {
-    if (index >= m_frameBuffer.size()) {
-        index %= m_frameBuffer.size();
+    const auto frame = getFrame(index);
+    if (!frame) {
+        return {};
     }
-    if (width == 0 || height == 0 || (width == m_width && height == m_height)) {
-        return m_frameBuffer[index];
-    } else {
-        return ImageSequence::resizeCover(
-            m_frameBuffer[index],
-            m_width,
-            m_height,
-            width,
-            height);
+    if (width == 0 || height == 0) {
+        width  = m_width;
+        height = m_height;
+    }
+    auto output = BufferPool<PixelBGRA>::global().acquire(static_cast<size_t>(width) * height);
+    if (!scaleCover(*frame,
+                    width,
+                    height,
+                    AV_PIX_FMT_BGRA,
+                    false,
+                    reinterpret_cast<uint8_t*>(output->data()),
+                    static_cast<int>(width * sizeof(PixelBGRA)))) {
+        return {};
+    }
+    return output.release();
+}
+
+vector<uint8_t>
+ImageSequenceFFmpegImpl::getFrameLuma(uint32_t index,
+                                      uint32_t width,
+                                      uint32_t height) noexcept {
+    const auto frame = getFrame(index);
+    if (!frame) {
+        return {};
+    }
+    if (width == 0) width = m_width;
+    if (height == 0) height = m_height;
+
+    // only a single channel is scaled, full range like toGray
+    auto output = BufferPool<uint8_t>::global().acquire(static_cast<size_t>(width) * height);
+    if (!scaleCover(*frame, width, height, AV_PIX_FMT_GRAY8, true, output->data(), static_cast<int>(width))) {
+        return {};
     }
+    return output.release();
 }
 
 bool
@@ -579,17 +1096,14 @@ ImageSequence::parseBase64(const string& base64) noexcept {
                     width  = frame->width;
                     height = frame->height;
 
-                    SwsContext* swsCtx = sws_getContext(
-                        width,
-                        height,
+                    SwsContext* swsCtx = SwsContextCache::get(
+                        static_cast<int>(width),
+                        static_cast<int>(height),
                         static_cast<AVPixelFormat>(frame->format),
-                        width,
-                        height,
+                        static_cast<int>(width),
+                        static_cast<int>(height),
                         AV_PIX_FMT_BGRA,
-                        SWS_BICUBIC,
-                        nullptr,
-                        nullptr,
-                        nullptr);
+                        SWS_BICUBIC);
 
                     if (!swsCtx) {
                         throw ImageParseException("Failed to create scaling context");
@@ -607,8 +1121,6 @@ ImageSequence::parseBase64(const string& base64) noexcept {
                         frame->height,
                         dstData,
                         dstLinesize);
-
-                    sws_freeContext(swsCtx);
                     break;
                 }
 
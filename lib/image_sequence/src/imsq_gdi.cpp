@@ -63,7 +63,7 @@ class ImageSequenceGdiplusImpl : public GIFImage::ImageSequence {
 };
 
 GIFImage::ImageSequence::Ref
-GIFImage::ImageSequence::read(const std::string& filename) noexcept {
+GIFImage::ImageSequence::read(const std::string& filename, const ReadOptions&) noexcept {
     try {
         std::string ext = filename.substr(filename.find_last_of('.') + 1);
         for (auto& c : ext) c = static_cast<char>(tolower(c));
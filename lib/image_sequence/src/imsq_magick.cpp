@@ -75,7 +75,7 @@ class ImageParseException final : public std::exception {
 };
 
 GIFImage::ImageSequenceRef
-GIFImage::ImageSequence::read(const std::string& filename) noexcept {
+GIFImage::ImageSequence::read(const std::string& filename, const ReadOptions&) noexcept {
     try {
         return std::make_unique<ImageSequenceImpl>(filename);
     } catch (const ImageParseException& e) {
@@ -1,25 +1,30 @@
 #include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <span>
+#include <string>
 #include <vector>
 
+#include "buffer_pool.h"
 #include "def.h"
 #include "imsq.h"
 #include "imsq_exception.h"
 #include "log.h"
 
+// the frames are only read where they are, the owner keeps them there
 class ImageSequenceNativeImpl : public GIFImage::ImageSequence {
   public:
     ImageSequenceNativeImpl(const std::span<const std::span<const PixelBGRA>>& frames,
                             const std::span<const uint32_t>& delays,
                             uint32_t width,
-                            uint32_t height) noexcept
-        : m_delays(delays.begin(), delays.end()),
+                            uint32_t height,
+                            std::shared_ptr<const void> owner)
+        : m_frames(frames.begin(), frames.end()),
+          m_owner(std::move(owner)),
+          m_delays(delays.begin(), delays.end()),
           m_width(width),
-          m_height(height) {
-        m_frames.reserve(frames.size());
-        for (const auto& frame : frames) {
-            m_frames.emplace_back(frame.begin(), frame.end());
-        }
-    }
+          m_height(height) {}
 
     ~ImageSequenceNativeImpl() noexcept override = default;
 
@@ -36,7 +41,39 @@ class ImageSequenceNativeImpl : public GIFImage::ImageSequence {
         if (index >= m_frames.size()) {
             index %= m_frames.size();
         }
-        return m_frames[index];
+        return {m_frames[index].begin(), m_frames[index].end()};
+    }
+
+    [[nodiscard]] GIFImage::FrameView
+    getFrameView(uint32_t index) noexcept override {
+        return {m_frames[index % m_frames.size()], m_owner};
+    }
+
+    [[nodiscard]] std::vector<uint8_t>
+    getFrameLuma(uint32_t index, uint32_t width, uint32_t height) noexcept override {
+        if (width != m_width || height != m_height) {
+            return {};
+        }
+        if (index >= m_frames.size()) {
+            index %= m_frames.size();
+        }
+        // straight from the stored frame, without copying it first
+        const auto& frame = m_frames[index];
+        auto luma         = GIFImage::BufferPool<uint8_t>::global().take(frame.size());
+        for (size_t i = 0; i < frame.size(); ++i) {
+            luma[i] = toGray(frame[i]).r;
+        }
+        return luma;
+    }
+
+    [[nodiscard]] bool
+    isSameAsPrevious(uint32_t index) noexcept override {
+        index %= m_frames.size();
+        if (index == 0) return false;
+        const auto& frame    = m_frames[index];
+        const auto& previous = m_frames[index - 1];
+        return frame.size() == previous.size() &&
+               std::memcmp(frame.data(), previous.data(), frame.size() * sizeof(PixelBGRA)) == 0;
     }
 
     [[nodiscard]] uint32_t
@@ -55,7 +92,8 @@ class ImageSequenceNativeImpl : public GIFImage::ImageSequence {
     }
 
   private:
-    std::vector<std::vector<PixelBGRA>> m_frames;
+    std::vector<std::span<const PixelBGRA>> m_frames;
+    std::shared_ptr<const void> m_owner;
     std::vector<uint32_t> m_delays;
     uint32_t m_width;
     uint32_t m_height;
@@ -66,6 +104,40 @@ GIFImage::ImageSequence::load(const std::span<const std::span<const PixelBGRA>>&
                               const std::span<const uint32_t>& delays,
                               uint32_t width,
                               uint32_t height) noexcept {
+    try {
+        std::vector<std::vector<PixelBGRA>> copies;
+        copies.reserve(frames.size());
+        for (const auto& frame : frames) {
+            copies.emplace_back(frame.begin(), frame.end());
+        }
+        return load(std::move(copies), delays, width, height);
+    } catch (const std::exception& e) {
+        GeneralLogger::error("Failed to load frames: " + std::string(e.what()));
+        return nullptr;
+    }
+}
+
+GIFImage::ImageSequence::Ref
+GIFImage::ImageSequence::load(std::vector<std::vector<PixelBGRA>>&& frames,
+                              const std::span<const uint32_t>& delays,
+                              uint32_t width,
+                              uint32_t height) noexcept {
+    try {
+        const auto owned = std::make_shared<const std::vector<std::vector<PixelBGRA>>>(std::move(frames));
+        const std::vector<std::span<const PixelBGRA>> spans(owned->begin(), owned->end());
+        return borrow(spans, delays, width, height, owned);
+    } catch (const std::exception& e) {
+        GeneralLogger::error("Failed to load frames: " + std::string(e.what()));
+        return nullptr;
+    }
+}
+
+GIFImage::ImageSequence::Ref
+GIFImage::ImageSequence::borrow(const std::span<const std::span<const PixelBGRA>>& frames,
+                                const std::span<const uint32_t>& delays,
+                                uint32_t width,
+                                uint32_t height,
+                                std::shared_ptr<const void> owner) noexcept {
     if (frames.empty() || delays.empty()) {
         return nullptr;
     }
@@ -81,9 +153,62 @@ GIFImage::ImageSequence::load(const std::span<const std::span<const PixelBGRA>>&
         }
     }
 
-    return std::make_unique<ImageSequenceNativeImpl>(frames, delays, width, height);
+    try {
+        return std::make_unique<ImageSequenceNativeImpl>(frames, delays, width, height, std::move(owner));
+    } catch (const std::exception& e) {
+        GeneralLogger::error("Failed to load frames: " + std::string(e.what()));
+        return nullptr;
+    }
+}
+
+GIFImage::FrameView
+GIFImage::ImageSequence::getFrameView(const uint32_t index) noexcept {
+    try {
+        // given back to the pool once the last view is gone
+        auto buffer = getFrameBuffer(index, 0, 0);
+        if (buffer.empty()) {
+            return {};
+        }
+        const std::shared_ptr<std::vector<PixelBGRA>> owner(
+            new std::vector<PixelBGRA>(std::move(buffer)),
+            [](std::vector<PixelBGRA>* frame) {
+                BufferPool<PixelBGRA>::global().recycle(std::move(*frame));
+                delete frame;
+            });
+        return {*owner, owner};
+    } catch (const std::exception& e) {
+        GeneralLogger::error("Failed to get frame: " + std::string(e.what()));
+        return {};
+    }
+}
+
+std::vector<uint8_t>
+GIFImage::ImageSequence::getFrameLuma(const uint32_t index, const uint32_t width, const uint32_t height) noexcept {
+    // at the original size straight from the frame, if the backend lends it
+    const bool isOriginalSize = (width == 0 || width == getWidth()) && (height == 0 || height == getHeight());
+    const auto view           = isOriginalSize ? getFrameView(index) : FrameView{};
+    const auto frame          = BufferPool<PixelBGRA>::global().adopt(
+        isOriginalSize ? std::vector<PixelBGRA>{} : getFrameBuffer(index, width, height));
+    const std::span<const PixelBGRA> pixels = isOriginalSize ? view.pixels : std::span<const PixelBGRA>(*frame);
+
+    auto luma = BufferPool<uint8_t>::global().take(pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        luma[i] = toGray(pixels[i]).r;
+    }
+    return luma;
+}
+
+bool
+GIFImage::ImageSequence::isSameAsPrevious(uint32_t) noexcept {
+    return false;
 }
 
+void
+GIFImage::ImageSequence::requestFrames(const std::span<const uint32_t>&) noexcept {}
+
+void
+GIFImage::ImageSequence::releaseDecoder() noexcept {}
+
 bool
 GIFImage::ImageSequence::drawMark(std::vector<PixelBGRA>& buffer,
                                   const uint32_t width,
@@ -228,7 +353,7 @@ GIFImage::ImageSequence::initDecoder(const char*) noexcept {
 }
 
 GIFImage::ImageSequence::Ref
-GIFImage::ImageSequence::read(const std::string&) noexcept {
+GIFImage::ImageSequence::read(const std::string&, const ReadOptions&) noexcept {
     GeneralLogger::error("Failed to decode image: No codec available");
     return nullptr;
 }
@@ -1,20 +1,28 @@
 #include <webp/decode.h>
 #include <webp/demux.h>
 
+#include <algorithm>
+#include <cstring>
 #include <exception>
-#include <filesystem>
-#include <fstream>
 #include <mutex>
+#include <span>
 
-#include "file_utils.h"
+#include "buffer_pool.h"
+#include "file_mapping.h"
 #include "imsq.h"
 #include "imsq_exception.h"
 #include "log.h"
 
+// frames are located once, then decoded straight from the mapped file.
+// frames that do not depend on the ones before them are decoded by any number of threads at once,
+// the others are composited in order on a shared canvas, starting from the closest canvas known.
 class ImageSequenceWebpImpl : public GIFImage::ImageSequence {
   public:
+    static constexpr uint32_t MIN_CHECKPOINT_INTERVAL = 8;          // frames
+    static constexpr uint64_t CHECKPOINT_BUDGET       = 64u << 20;  // bytes of canvases kept for random access
+
     explicit ImageSequenceWebpImpl(const std::string& filename);
-    ~ImageSequenceWebpImpl() override;
+    ~ImageSequenceWebpImpl() override = default;
 
     [[nodiscard]] const std::vector<uint32_t>&
     getDelays() noexcept override {
@@ -40,66 +48,67 @@ class ImageSequenceWebpImpl : public GIFImage::ImageSequence {
     getFrameBuffer(uint32_t index, uint32_t width, uint32_t height) noexcept override;
 
   private:
-    WebPData m_webpData{};
-    WebPDemuxer* m_demux = nullptr;
-    WebPDecoderConfig m_config{};
+    struct WebpFrame {
+        std::span<const uint8_t> fragment;  // within the mapped file
+        uint32_t x               = 0;
+        uint32_t y               = 0;
+        uint32_t width           = 0;
+        uint32_t height          = 0;
+        bool blend               = false;  // alpha-blended onto the canvas, otherwise it replaces its area
+        bool disposeToBackground = false;  // its area is cleared to transparent before the next frame
+        bool isKeyFrame          = false;  // drawn on a cleared canvas, as nothing before it shows
+    };
+
+    [[nodiscard]] bool
+    isFullCanvas(const WebpFrame& frame) const noexcept {
+        return frame.width == m_width && frame.height == m_height;
+    }
+
+    void
+    decodeFragment(const WebpFrame& frame, PixelBGRA* dst, size_t stride) const;
+
+    void
+    composite(uint32_t index, PixelBGRA* canvas) const;
+
+    void
+    seekCanvas(uint32_t index);
+
+    NaiveIO::FileMapping::Ref m_file;
+    std::vector<WebpFrame> m_frames;
     std::vector<uint32_t> m_delays;
     uint32_t m_frameCount = 0;
     uint32_t m_width      = 0;
     uint32_t m_height     = 0;
-    std::mutex m_demuxMutex;
-};
 
-inline bool
-readFileToWebPData(const std::string& filename, WebPData* webp_data) {
-    const auto localized = NaiveIO::checkFileExists(filename);
-    if (localized.empty()) {
-        return false;
-    }
-    const std::filesystem::path filePath(localized);
-    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        return false;
-    }
-
-    const size_t fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    auto* data = new uint8_t[fileSize];
-    if (!file.read(reinterpret_cast<char*>(data), fileSize)) {
-        delete[] data;
-        return false;
-    }
-
-    webp_data->bytes = data;
-    webp_data->size  = fileSize;
-    return true;
-}
+    std::mutex m_canvasMutex;  // guards the canvases below
+    std::vector<PixelBGRA> m_canvas;
+    uint32_t m_canvasIndex        = 0;  // frame m_canvas shows, m_frameCount if none
+    uint32_t m_checkpointInterval = MIN_CHECKPOINT_INTERVAL;
+    std::vector<std::vector<PixelBGRA>> m_checkpoints;  // canvas of every interval-th frame, empty until composited
+};
 
 ImageSequenceWebpImpl::ImageSequenceWebpImpl(const std::string& filename) {
+    WebPDemuxer* demux = nullptr;
     try {
         GeneralLogger::info("Loading WebP image: " + filename, GeneralLogger::STEP);
 
-        WebPDataInit(&m_webpData);
-
-        if (!readFileToWebPData(filename, &m_webpData)) {
+        m_file = NaiveIO::FileMapping::create(filename);
+        if (!m_file) {
             throw ImageParseException("Failed to read WebP file: " + filename);
         }
 
-        m_demux = WebPDemux(&m_webpData);
-        if (m_demux == nullptr) {
-            throw ImageParseException("Failed to create WebP demuxer for: " + filename);
-        }
+        WebPData webpData;
+        WebPDataInit(&webpData);
+        webpData.bytes = m_file->getData().data();
+        webpData.size  = m_file->getData().size();
 
-        m_frameCount = WebPDemuxGetI(m_demux, WEBP_FF_FRAME_COUNT);
-        if (m_frameCount == 0) {
-            GeneralLogger::warn("WebP image has no frames: " + filename);
-            m_frameCount = 1;
+        demux = WebPDemux(&webpData);
+        if (demux == nullptr) {
+            throw ImageParseException("Failed to create WebP demuxer for: " + filename);
         }
-        GeneralLogger::info("Frame count: " + std::to_string(m_frameCount), GeneralLogger::DETAIL);
 
-        m_width  = WebPDemuxGetI(m_demux, WEBP_FF_CANVAS_WIDTH);
-        m_height = WebPDemuxGetI(m_demux, WEBP_FF_CANVAS_HEIGHT);
+        m_width  = WebPDemuxGetI(demux, WEBP_FF_CANVAS_WIDTH);
+        m_height = WebPDemuxGetI(demux, WEBP_FF_CANVAS_HEIGHT);
         GeneralLogger::info("Image dimensions: " + std::to_string(m_width) + "x" + std::to_string(m_height),
                             GeneralLogger::DETAIL);
 
@@ -107,48 +116,163 @@ ImageSequenceWebpImpl::ImageSequenceWebpImpl(const std::string& filename) {
             throw ImageParseException("Invalid WebP image dimensions: " + filename);
         }
 
-        if (!WebPInitDecoderConfig(&m_config)) {
-            throw ImageParseException("Failed to initialize WebP decoder for: " + filename);
-        }
-
-        m_delays.resize(m_frameCount);
+        // the fragments point into the mapped file, so they outlive the demuxer
         WebPIterator iter;
-        if (WebPDemuxGetFrame(m_demux, 1, &iter)) {
-            uint32_t frame_index = 0;
+        if (WebPDemuxGetFrame(demux, 1, &iter)) {
             do {
-                m_delays[frame_index] = iter.duration;
-                if (m_delays[frame_index] == 0) {
-                    m_delays[frame_index] = GIFImage::ImageSequence::DEFAULT_DELAY;
+                WebpFrame frame;
+                frame.fragment            = {iter.fragment.bytes, iter.fragment.size};
+                frame.x                   = static_cast<uint32_t>(iter.x_offset);
+                frame.y                   = static_cast<uint32_t>(iter.y_offset);
+                frame.width               = static_cast<uint32_t>(iter.width);
+                frame.height              = static_cast<uint32_t>(iter.height);
+                frame.blend               = iter.blend_method == WEBP_MUX_BLEND;
+                frame.disposeToBackground = iter.dispose_method == WEBP_MUX_DISPOSE_BACKGROUND;
+                if (frame.x + static_cast<uint64_t>(frame.width) > m_width ||
+                    frame.y + static_cast<uint64_t>(frame.height) > m_height) {
+                    WebPDemuxReleaseIterator(&iter);
+                    throw ImageParseException("WebP frame out of the canvas: " + filename);
                 }
-                frame_index++;
-            } while (WebPDemuxNextFrame(&iter) && frame_index < m_frameCount);
+                // the same rules as WebPAnimDecoder
+                if (m_frames.empty()) {
+                    frame.isKeyFrame = true;
+                } else if ((!iter.has_alpha || !frame.blend) && isFullCanvas(frame)) {
+                    frame.isKeyFrame = true;
+                } else {
+                    const auto& previous = m_frames.back();
+                    frame.isKeyFrame     = previous.disposeToBackground && (isFullCanvas(previous) || previous.isKeyFrame);
+                }
+                m_frames.push_back(frame);
+                m_delays.push_back(iter.duration > 0 ? static_cast<uint32_t>(iter.duration)
+                                                     : GIFImage::ImageSequence::DEFAULT_DELAY);
+            } while (WebPDemuxNextFrame(&iter));
             WebPDemuxReleaseIterator(&iter);
-        } else {
-            GeneralLogger::warn("Failed to get WebP frame iterator: " + filename);
-            for (uint32_t i = 0; i < m_frameCount; ++i) {
-                m_delays[i] = GIFImage::ImageSequence::DEFAULT_DELAY;
-            }
         }
+        WebPDemuxDelete(demux);
+        demux = nullptr;
+
+        m_frameCount = static_cast<uint32_t>(m_frames.size());
+        if (m_frameCount == 0) {
+            throw ImageParseException("WebP image has no frames: " + filename);
+        }
+        GeneralLogger::info("Frame count: " + std::to_string(m_frameCount), GeneralLogger::DETAIL);
+
+        // checkpoints of all frames fit in the budget together
+        const uint64_t canvasBytes = static_cast<uint64_t>(m_width) * m_height * sizeof(PixelBGRA);
+        const uint64_t interval    = (m_frameCount * canvasBytes + CHECKPOINT_BUDGET - 1) / CHECKPOINT_BUDGET;
+        m_checkpointInterval       = static_cast<uint32_t>(std::max<uint64_t>(interval, MIN_CHECKPOINT_INTERVAL));
+        m_checkpoints.resize((m_frameCount + m_checkpointInterval - 1) / m_checkpointInterval);
+        m_canvasIndex = m_frameCount;
     } catch (const std::exception& _) {
+        if (demux) WebPDemuxDelete(demux);
         throw;
     } catch (...) {
+        if (demux) WebPDemuxDelete(demux);
         throw ImageParseException("Failed to parse WebP image: " + filename);
     }
 }
 
-ImageSequenceWebpImpl::~ImageSequenceWebpImpl() {
-    if (m_demux) {
-        WebPDemuxDelete(m_demux);
-        m_demux = nullptr;
+void
+ImageSequenceWebpImpl::decodeFragment(const WebpFrame& frame, PixelBGRA* dst, const size_t stride) const {
+    // a config per call, the decoder keeps no other state
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
+        throw ImageParseException("Failed to initialize WebP decoder.");
     }
+    config.options.use_threads       = 1;
+    config.output.colorspace         = MODE_BGRA;
+    config.output.is_external_memory = 1;
+
+    config.output.u.RGBA.rgba   = reinterpret_cast<uint8_t*>(dst);
+    config.output.u.RGBA.stride = static_cast<int>(stride * sizeof(PixelBGRA));
+    config.output.u.RGBA.size   = (stride * (frame.height - 1) + frame.width) * sizeof(PixelBGRA);
+    config.output.width         = static_cast<int>(frame.width);
+    config.output.height        = static_cast<int>(frame.height);
+
+    VP8StatusCode status = WebPDecode(frame.fragment.data(), frame.fragment.size(), &config);
+    if (status != VP8_STATUS_OK) {
+        throw ImageParseException("Failed to decode WebP frame, status: " + std::to_string(status));
+    }
+}
+
+// source over destination, both not premultiplied, the same way as WebPAnimDecoder
+static PixelBGRA
+blendPixel(const PixelBGRA& src, const PixelBGRA& dst) {
+    if (src.a == 0) {
+        return dst;
+    }
+    const uint32_t dstFactor = (dst.a * (256u - src.a)) >> 8;
+    const uint32_t alpha     = src.a + dstFactor;
+    const uint32_t scale     = (1u << 24) / alpha;
+    const auto channel       = [&](const uint8_t s, const uint8_t d) {
+        return TOU8(((s * src.a + d * dstFactor) * scale) >> 24);
+    };
+    return makeBGRA(channel(src.b, dst.b), channel(src.g, dst.g), channel(src.r, dst.r), TOU8(alpha));
+}
 
-    if (m_webpData.bytes) {
-        delete[] m_webpData.bytes;
-        m_webpData.bytes = nullptr;
-        m_webpData.size  = 0;
+void
+ImageSequenceWebpImpl::composite(const uint32_t index, PixelBGRA* canvas) const {
+    const auto& frame = m_frames[index];
+    if (frame.isKeyFrame) {
+        if (isFullCanvas(frame)) {
+            decodeFragment(frame, canvas, m_width);
+            return;
+        }
+        std::fill_n(canvas, static_cast<size_t>(m_width) * m_height, PixelBGRA{0, 0, 0, 0});
+    } else if (const auto& previous = m_frames[index - 1]; previous.disposeToBackground) {
+        for (uint32_t y = previous.y; y < previous.y + previous.height; ++y) {
+            std::fill_n(canvas + static_cast<size_t>(y) * m_width + previous.x, previous.width, PixelBGRA{0, 0, 0, 0});
+        }
+    }
+    if (frame.isKeyFrame || !frame.blend) {
+        decodeFragment(frame, canvas + static_cast<size_t>(frame.y) * m_width + frame.x, m_width);
+        return;
+    }
+    auto pixels = GIFImage::BufferPool<PixelBGRA>::global().acquire(static_cast<size_t>(frame.width) * frame.height);
+    decodeFragment(frame, pixels->data(), frame.width);
+    for (uint32_t y = 0; y < frame.height; ++y) {
+        const PixelBGRA* src = pixels->data() + static_cast<size_t>(y) * frame.width;
+        PixelBGRA* dst       = canvas + static_cast<size_t>(frame.y + y) * m_width + frame.x;
+        for (uint32_t x = 0; x < frame.width; ++x) {
+            dst[x] = blendPixel(src[x], dst[x]);
+        }
     }
 }
 
+void
+ImageSequenceWebpImpl::seekCanvas(const uint32_t index) {
+    if (m_canvasIndex == index) {
+        return;
+    }
+    m_canvas.resize(static_cast<size_t>(m_width) * m_height);
+
+    // the closest state to start compositing from: the running canvas, a checkpoint or a key frame
+    uint32_t keyFrame = index;
+    while (!m_frames[keyFrame].isKeyFrame) --keyFrame;
+    uint32_t next = keyFrame;
+    if (m_canvasIndex < index && m_canvasIndex >= keyFrame) {
+        next = m_canvasIndex + 1;
+    }
+    for (uint32_t slot = index / m_checkpointInterval + 1; slot-- > 0;) {
+        const uint32_t checkpoint = slot * m_checkpointInterval;
+        if (checkpoint < keyFrame || checkpoint < next) break;
+        if (!m_checkpoints[slot].empty()) {
+            m_canvas = m_checkpoints[slot];
+            next     = checkpoint + 1;
+            break;
+        }
+    }
+
+    m_canvasIndex = m_frameCount;  // unknown until done
+    for (uint32_t i = next; i <= index; ++i) {
+        composite(i, m_canvas.data());
+        if (i % m_checkpointInterval == 0 && !m_frames[i].isKeyFrame && m_checkpoints[i / m_checkpointInterval].empty()) {
+            m_checkpoints[i / m_checkpointInterval] = m_canvas;
+        }
+    }
+    m_canvasIndex = index;
+}
+
 std::vector<PixelBGRA>
 ImageSequenceWebpImpl::getFrameBuffer(uint32_t index, uint32_t width, uint32_t height) noexcept {
     try {
@@ -159,44 +283,20 @@ ImageSequenceWebpImpl::getFrameBuffer(uint32_t index, uint32_t width, uint32_t h
         if (width == 0) width = m_width;
         if (height == 0) height = m_height;
 
-        {
-            std::lock_guard<std::mutex> lock(m_demuxMutex);
-
-            WebPIterator iter;
-            if (!WebPDemuxGetFrame(m_demux, index + 1, &iter)) {
-                throw ImageParseException("Failed to get WebP frame at index: " + std::to_string(index));
-            }
-            const uint32_t srcWidth = iter.width, srcHeight = iter.height;
-            if (srcWidth != m_width || srcHeight != m_height) {
-                GeneralLogger::warn("WebP frame dimensions do not match: " + std::to_string(srcWidth) + "x" +
-                                    std::to_string(srcHeight) + " != " + std::to_string(m_width) + "x" +
-                                    std::to_string(m_height));
-            }
-
-            m_config.options.use_threads       = 1;
-            m_config.output.colorspace         = MODE_BGRA;
-            m_config.output.is_external_memory = 1;
-
-            std::vector<PixelBGRA> tempBuffer(srcWidth * srcHeight);
-
-            m_config.output.u.RGBA.rgba   = reinterpret_cast<uint8_t*>(tempBuffer.data());
-            m_config.output.u.RGBA.stride = srcWidth * 4;
-            m_config.output.u.RGBA.size   = tempBuffer.size() * 4;
-            m_config.output.width         = srcWidth;
-            m_config.output.height        = srcHeight;
-
-            VP8StatusCode status = WebPDecode(iter.fragment.bytes, iter.fragment.size, &m_config);
-            WebPDemuxReleaseIterator(&iter);
-
-            if (status != VP8_STATUS_OK) {
-                throw ImageParseException("Failed to decode WebP frame, status: " + std::to_string(status));
-            }
+        auto canvas = GIFImage::BufferPool<PixelBGRA>::global().acquire(static_cast<size_t>(m_width) * m_height);
+        if (m_frames[index].isKeyFrame) {
+            // nothing before it shows, so it does not need the shared canvas
+            composite(index, canvas->data());
+        } else {
+            std::lock_guard<std::mutex> lock(m_canvasMutex);
+            seekCanvas(index);
+            std::copy(m_canvas.begin(), m_canvas.end(), canvas->begin());
+        }
 
-            if (width == srcWidth && height == srcHeight) {
-                return tempBuffer;
-            } else {
-                return resizeCover(tempBuffer, srcWidth, srcHeight, width, height);
-            }
+        if (width == m_width && height == m_height) {
+            return canvas.release();
+        } else {
+            return resizeCover(*canvas, m_width, m_height, width, height);
         }
     } catch (const std::exception& e) {
         GeneralLogger::error("Error getting WebP frame buffer: " + std::string(e.what()));
@@ -205,4 +305,4 @@ ImageSequenceWebpImpl::getFrameBuffer(uint32_t index, uint32_t width, uint32_t h
         GeneralLogger::error("Unknown error getting WebP frame buffer.");
         return {};
     }
-}
\ No newline at end of file
+}
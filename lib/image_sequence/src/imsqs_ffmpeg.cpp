@@ -4,9 +4,11 @@
 #include <string>
 #include <vector>
 
+#include "buffer_pool.h"
 #include "imsq_exception.h"
 #include "imsq_stream.h"
 #include "log.h"
+#include "sws_cache.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -27,7 +29,7 @@ class EOFException : public std::exception {};
 
 class ImageSequenceStreamFFmpegImpl : public ImageSequenceStream {
   public:
-    explicit ImageSequenceStreamFFmpegImpl(const string& filename);
+    ImageSequenceStreamFFmpegImpl(const string& filename, const ReadOptions& options);
 
     ~ImageSequenceStreamFFmpegImpl() noexcept override;
 
@@ -49,21 +51,22 @@ class ImageSequenceStreamFFmpegImpl : public ImageSequenceStream {
     AVCodecParameters* m_codecParams = nullptr;
     const AVCodec* m_codec           = nullptr;
 
-    bool m_eof     = false;
-    bool m_inFrame = false;
+    bool m_eof      = false;
+    bool m_inFrame  = false;
+    bool m_draining = false;  // the end of the file was sent to the decoder
 };
 
 ImageSequenceStream::Ref
-ImageSequenceStream::read(const string& filename) noexcept {
+ImageSequenceStream::read(const string& filename, const ReadOptions& options) noexcept {
     try {
-        return std::make_unique<ImageSequenceStreamFFmpegImpl>(filename);
+        return std::make_unique<ImageSequenceStreamFFmpegImpl>(filename, options);
     } catch (const ImageParseException& e) {
         GeneralLogger::error("Error reading image sequence: " + string(e.what()));
         return nullptr;
     }
 }
 
-ImageSequenceStreamFFmpegImpl::ImageSequenceStreamFFmpegImpl(const string& filename) {
+ImageSequenceStreamFFmpegImpl::ImageSequenceStreamFFmpegImpl(const string& filename, const ReadOptions& options) {
     try {
         if (avformat_open_input(&m_formatCtx, filename.c_str(), nullptr, nullptr) < 0) {
             throw ImageParseException("Failed to open file: " + filename);
@@ -90,6 +93,9 @@ ImageSequenceStreamFFmpegImpl::ImageSequenceStreamFFmpegImpl(const string& filen
             throw ImageParseException("Failed to allocate decoder context.");
         }
         avcodec_parameters_to_context(m_codecCtx, m_codecParams);
+        // frames still come out in presentation order, only later
+        m_codecCtx->thread_count = static_cast<int>(options.decoderThreads);
+        m_codecCtx->thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
 
         if (avcodec_open2(m_codecCtx, m_codec, nullptr) < 0) {
             throw ImageParseException("Failed to open decoder.");
@@ -125,7 +131,15 @@ ImageSequenceStreamFFmpegImpl::getNextFrame() noexcept {
         while (true) {
             if (!m_inFrame) {
                 while (true) {
+                    if (m_draining) {
+                        throw EOFException();
+                    }
                     if (av_read_frame(m_formatCtx, m_packet) < 0) {
+                        // flush the frames the decoder still holds, threaded decoders hold several
+                        m_draining = true;
+                        if (avcodec_send_packet(m_codecCtx, nullptr) >= 0) {
+                            break;
+                        }
                         throw EOFException();
                     }
                     if (m_packet->stream_index == m_videoStreamIndex) {
@@ -151,7 +165,7 @@ ImageSequenceStreamFFmpegImpl::getNextFrame() noexcept {
                 Frame::Ref frame = std::make_unique<Frame>();
                 frame->width     = m_frame->width;
                 frame->height    = m_frame->height;
-                frame->buffer.resize(frame->width * frame->height);
+                frame->buffer    = BufferPool<PixelBGRA>::global().take(static_cast<size_t>(frame->width) * frame->height);
 
                 if (m_frame->duration > 0) {
                     uint32_t durationMs = static_cast<uint32_t>(m_frame->duration * av_q2d(m_timeBase) * 1000);
@@ -160,17 +174,14 @@ ImageSequenceStreamFFmpegImpl::getNextFrame() noexcept {
                     frame->delay = DEFAULT_DELAY;
                 }
 
-                SwsContext* swsCtx = sws_getContext(
+                SwsContext* swsCtx = SwsContextCache::get(
                     m_frame->width,
                     m_frame->height,
                     static_cast<AVPixelFormat>(m_frame->format),
                     m_frame->width,
                     m_frame->height,
                     AV_PIX_FMT_BGRA,
-                    SWS_POINT,
-                    nullptr,
-                    nullptr,
-                    nullptr);
+                    SWS_POINT);
                 if (!swsCtx) {
                     throw ImageParseException("Failed to create sws context.");
                 }
@@ -184,7 +195,6 @@ ImageSequenceStreamFFmpegImpl::getNextFrame() noexcept {
                     m_frame->height,
                     dstData,
                     dstLineSize);
-                sws_freeContext(swsCtx);
                 return frame;
             } catch (const ImageParseException& e) {
                 GeneralLogger::error("Error processing frame: " + string(e.what()) + ", skipping frame.");
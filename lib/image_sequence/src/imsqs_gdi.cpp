@@ -34,7 +34,7 @@ ImageSequenceStream::initDecoder(const char*) noexcept {
 }
 
 ImageSequenceStream::Ref
-ImageSequenceStream::read(const string& filename) noexcept {
+ImageSequenceStream::read(const string& filename, const ReadOptions&) noexcept {
     try {
         return std::make_unique<ImageSequenceStreamGdiplusImpl>(filename);
     } catch (const ImageParseException& e) {
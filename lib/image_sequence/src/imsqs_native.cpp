@@ -85,7 +85,7 @@ ImageSequenceStream::initDecoder(const char*) noexcept {
 }
 
 ImageSequenceStream::Ref
-ImageSequenceStream::read(const std::string&) noexcept {
+ImageSequenceStream::read(const std::string&, const ReadOptions&) noexcept {
     GeneralLogger::error("Failed to decode image: No codec available");
     return nullptr;
 }
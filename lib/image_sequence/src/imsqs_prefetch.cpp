@@ -0,0 +1,122 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "imsq_stream.h"
+#include "log.h"
+
+using namespace GIFImage;
+
+/**
+ * @brief Decodes the frames of another stream ahead on a worker thread.
+ *
+ * The frames are handed out in the order and with the end of stream of the source,
+ * while at most a fixed number of them wait in the queue.
+ */
+class ImageSequenceStreamPrefetchImpl : public ImageSequenceStream {
+  public:
+    /**
+     * @param source Stream to read from, given back if the worker cannot be started.
+     * @param capacity Frames decoded ahead at most.
+     */
+    ImageSequenceStreamPrefetchImpl(Ref& source, const size_t capacity)
+        : m_source(std::move(source)),
+          m_capacity(capacity) {
+        try {
+            m_worker = std::thread(&ImageSequenceStreamPrefetchImpl::run, this);
+        } catch (...) {
+            source = std::move(m_source);
+            throw;
+        }
+    }
+
+    ~ImageSequenceStreamPrefetchImpl() noexcept override {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_notFull.notify_all();
+        // waits for the frame being decoded, if any
+        m_worker.join();
+    }
+
+    [[nodiscard]] Frame::Ref
+    getNextFrame() noexcept override {
+        std::unique_lock lock(m_mutex);
+        m_notEmpty.wait(lock, [this]() { return !m_queue.empty() || m_done; });
+        if (m_queue.empty()) {
+            return nullptr;
+        }
+        Frame::Ref frame = std::move(m_queue.front());
+        m_queue.pop_front();
+        lock.unlock();
+        m_notFull.notify_one();
+        return frame;
+    }
+
+    [[nodiscard]] bool
+    isEndOfStream() const noexcept override {
+        std::lock_guard lock(m_mutex);
+        return m_done && m_queue.empty();
+    }
+
+  private:
+    void
+    run() noexcept {
+        while (true) {
+            // the source is only used by this thread
+            Frame::Ref frame = m_source->getNextFrame();
+            const bool eos   = m_source->isEndOfStream();
+
+            std::unique_lock lock(m_mutex);
+            m_notFull.wait(lock, [this]() { return m_queue.size() < m_capacity || m_stop; });
+            if (m_stop) {
+                return;
+            }
+            // frames the source failed on are passed on as well, the end of stream is not
+            if (frame || !eos) {
+                try {
+                    m_queue.push_back(std::move(frame));
+                } catch (...) {
+                    GeneralLogger::error("Failed to queue frame, ending stream.");
+                    m_done = true;
+                }
+            }
+            if (eos) {
+                m_done = true;
+            }
+            const bool done = m_done;
+            lock.unlock();
+            m_notEmpty.notify_one();
+            if (done) {
+                return;
+            }
+        }
+    }
+
+    Ref m_source;
+    const size_t m_capacity;
+
+    mutable std::mutex m_mutex;  // guards the queue and flags below
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<Frame::Ref> m_queue;
+    bool m_done = false;  // the worker has read the whole source
+    bool m_stop = false;  // the stream is being destroyed
+
+    std::thread m_worker;
+};
+
+ImageSequenceStream::Ref
+ImageSequenceStream::prefetch(Ref source, const size_t capacity) noexcept {
+    if (!source || capacity == 0) {
+        return source;
+    }
+    try {
+        return std::make_unique<ImageSequenceStreamPrefetchImpl>(source, capacity);
+    } catch (const std::exception& e) {
+        GeneralLogger::warn("Failed to start prefetching, decoding on demand: " + std::string(e.what()));
+        return source;
+    }
+}
@@ -27,6 +27,7 @@
 #include <chrono>
 #endif  // IMSQ_DEBUG
 
+#include "buffer_pool.h"
 #include "def.h"
 #include "log.h"
 #include "quantizer.h"
@@ -977,9 +978,10 @@ GIFImage::quantize(const std::span<PixelBGRA>& pixels,
 #endif  // IMSQ_DEBUG
     // apply dithering if needed
     if (ditherMode == DitherMode::DitherFloydSteinberg) {
-        auto pixelCpy = std::vector<PixelBGRA>(pixels.begin(), pixels.end());
+        auto pixelCpy = BufferPool<PixelBGRA>::global().acquire(pixels.size());
+        std::copy(pixels.begin(), pixels.end(), pixelCpy->begin());
         floydSteinbergDithering(
-            pixelCpy,
+            *pixelCpy,
             result.palette,
             result.indices,
             width,
@@ -988,9 +990,10 @@ GIFImage::quantize(const std::span<PixelBGRA>& pixels,
             transparency,
             transparentThreshold);
     } else if (ditherMode == DitherMode::DitherOrdered) {
-        auto pixelCpy = std::vector<PixelBGRA>(pixels.begin(), pixels.end());
+        auto pixelCpy = BufferPool<PixelBGRA>::global().acquire(pixels.size());
+        std::copy(pixels.begin(), pixels.end(), pixelCpy->begin());
         orderedDithering(
-            pixelCpy,
+            *pixelCpy,
             result.palette,
             result.indices,
             width,
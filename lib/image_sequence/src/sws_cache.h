@@ -0,0 +1,119 @@
+#ifndef IMAGE_SEQUENCE_SWS_CACHE_H
+#define IMAGE_SEQUENCE_SWS_CACHE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+/**
+ * @brief Scaling contexts of the calling thread, one per conversion.
+ *
+ * Creating a context sets up the filter coefficients, which often costs more
+ * than converting a small frame, so contexts are kept for the next frame.
+ * A context is only ever used by the thread that created it.
+ */
+class SwsContextCache {
+  public:
+    static constexpr size_t CAPACITY = 16;  // contexts kept per thread
+
+    /**
+     * @brief Get the context for a conversion, created on first use.
+     *        It stays valid until the calling thread gets more than CAPACITY other conversions or exits.
+     * @param fullRange Whether to convert to full range, like toGray does, instead of the default limited range.
+     * @param srcFullRange Whether a YUV source is full range, only used with fullRange.
+     *
+     * @return nullptr if the context cannot be created.
+     */
+    static SwsContext*
+    get(const int srcWidth,
+        const int srcHeight,
+        const AVPixelFormat srcFormat,
+        const int dstWidth,
+        const int dstHeight,
+        const AVPixelFormat dstFormat,
+        const int flags,
+        const bool fullRange    = false,
+        const bool srcFullRange = true) noexcept {
+        const Key key{srcWidth, srcHeight, srcFormat, dstWidth, dstHeight, dstFormat, flags, fullRange, fullRange && srcFullRange};
+
+        thread_local std::vector<Entry> entries;  // most recently used first
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].key == key) {
+                std::rotate(entries.begin(), entries.begin() + i, entries.begin() + i + 1);
+                return entries[0].context.get();
+            }
+        }
+
+        SwsContext* swsCtx = sws_getContext(
+            srcWidth,
+            srcHeight,
+            srcFormat,
+            dstWidth,
+            dstHeight,
+            dstFormat,
+            flags,
+            nullptr,
+            nullptr,
+            nullptr);
+        if (!swsCtx) {
+            return nullptr;
+        }
+        if (fullRange) {
+            sws_setColorspaceDetails(swsCtx,
+                                     sws_getCoefficients(SWS_CS_DEFAULT),
+                                     srcFullRange ? 1 : 0,
+                                     sws_getCoefficients(SWS_CS_DEFAULT),
+                                     1,
+                                     0,
+                                     1 << 16,
+                                     1 << 16);
+        }
+        try {
+            if (entries.size() >= CAPACITY) {
+                entries.pop_back();
+            }
+            entries.insert(entries.begin(), Entry{key, ContextRef(swsCtx)});
+        } catch (...) {
+            sws_freeContext(swsCtx);
+            return nullptr;
+        }
+        return swsCtx;
+    }
+
+  private:
+    struct Key {
+        int srcWidth;
+        int srcHeight;
+        AVPixelFormat srcFormat;
+        int dstWidth;
+        int dstHeight;
+        AVPixelFormat dstFormat;
+        int flags;
+        bool fullRange;
+        bool srcFullRange;
+
+        bool
+        operator==(const Key&) const = default;
+    };
+
+    struct ContextDeleter {
+        void
+        operator()(SwsContext* swsCtx) const noexcept {
+            sws_freeContext(swsCtx);
+        }
+    };
+
+    using ContextRef = std::unique_ptr<SwsContext, ContextDeleter>;
+
+    struct Entry {
+        Key key;
+        ContextRef context;
+    };
+};
+
+#endif  // IMAGE_SEQUENCE_SWS_CACHE_H
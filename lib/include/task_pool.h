@@ -0,0 +1,192 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Fixed size thread pool with one task queue per worker.
+ *
+ * Tasks submitted from outside are spread over the queues round-robin,
+ * tasks submitted from a worker go to its own queue.
+ * A worker runs its own tasks in submission order and, once they are
+ * exhausted, steals the most recently queued task of another worker,
+ * so uneven task costs do not leave threads idle.
+ */
+class TaskPool {
+  public:
+    using Task = std::function<void()>;
+
+    struct WorkerStats {
+        size_t tasks       = 0;  // tasks run
+        size_t stolen      = 0;  // of which taken from other workers
+        double busySeconds = 0;  // time spent running tasks
+    };
+
+    explicit TaskPool(uint32_t threadCount)
+        : m_queues(threadCount == 0 ? 1 : threadCount),
+          m_stats(m_queues.size()) {
+        for (auto& queue : m_queues) {
+            queue = std::make_unique<Queue>();
+        }
+        m_threads.reserve(m_queues.size());
+        for (size_t i = 0; i < m_queues.size(); ++i) {
+            m_threads.emplace_back([this, i]() { workerLoop(i); });
+        }
+    }
+
+    TaskPool(const TaskPool&)            = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    ~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_taskCv.notify_all();
+        for (auto& thread : m_threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+    void
+    submit(Task task) {
+        size_t index;
+        if (s_currentPool == this) {
+            index = s_currentWorker;
+        } else {
+            index = m_nextQueue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+        }
+        m_pending.fetch_add(1, std::memory_order_acq_rel);
+        m_queued.fetch_add(1, std::memory_order_acq_rel);
+        {
+            std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_taskCv.notify_one();
+    }
+
+    /**
+     * @brief Block until every submitted task has finished.
+     *        Rethrows the first exception thrown by a task, if any.
+     *        Must not be called from a worker.
+     */
+    void
+    wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_doneCv.wait(lock, [this]() { return m_pending.load(std::memory_order_acquire) == 0; });
+        if (m_exception) {
+            std::rethrow_exception(std::exchange(m_exception, nullptr));
+        }
+    }
+
+    [[nodiscard]] size_t
+    getThreadCount() const noexcept {
+        return m_threads.size();
+    }
+
+    /**
+     * @brief Per worker statistics, only consistent while no task is running.
+     */
+    [[nodiscard]] const std::vector<WorkerStats>&
+    getStats() const noexcept {
+        return m_stats;
+    }
+
+  private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool
+    popOwn(const size_t index, Task& task) {
+        auto& queue = *m_queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool
+    steal(const size_t index, Task& task) {
+        for (size_t i = 1; i < m_queues.size(); ++i) {
+            auto& queue = *m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    void
+    workerLoop(const size_t index) {
+        s_currentPool   = this;
+        s_currentWorker = index;
+        auto& stats     = m_stats[index];
+        while (true) {
+            Task task;
+            bool stolen = false;
+            if (popOwn(index, task) || (stolen = steal(index, task))) {
+                m_queued.fetch_sub(1, std::memory_order_acq_rel);
+                const auto start = std::chrono::steady_clock::now();
+                try {
+                    task();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!m_exception) m_exception = std::current_exception();
+                }
+                stats.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                ++stats.tasks;
+                if (stolen) ++stats.stolen;
+                if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_doneCv.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_taskCv.wait(lock, [this]() { return m_stop || m_queued.load(std::memory_order_acquire) > 0; });
+            if (m_stop && m_queued.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<WorkerStats> m_stats;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;  // guards sleeping, m_stop and m_exception
+    std::condition_variable m_taskCv;
+    std::condition_variable m_doneCv;
+    std::atomic<size_t> m_pending{0};    // submitted but not finished
+    std::atomic<size_t> m_queued{0};     // waiting in a queue
+    std::atomic<size_t> m_nextQueue{0};  // round-robin target for external submissions
+    std::exception_ptr m_exception;
+    bool m_stop = false;
+
+    static inline thread_local const TaskPool* s_currentPool = nullptr;
+    static inline thread_local size_t s_currentWorker        = 0;
+};
+
+#endif  // TASK_POOL_H
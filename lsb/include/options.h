@@ -15,6 +15,7 @@ namespace GIFLsb {
 class DecodeOptions {
   public:
     GIFImage::ImageSequenceStream::Ref image;
+    GIFImage::ReadOptions readOptions;
     std::string imagePath;
     NaiveIO::FileWriter::Ref outputFile;
     std::string outputName;
@@ -46,6 +47,7 @@ class EncodeOptions {
 
   public:
     GIFImage::ImageSequence::Ref image;
+    GIFImage::ReadOptions readOptions;
     NaiveIO::FileReader::Ref file;
     NaiveIO::FileWriter::Ref outputFile;
     std::string imagePath;
@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 
+#include "buffer_pool.h"
 #include "file_utils.h"
 #include "gif_lsb.h"
 #include "imsq_stream.h"
@@ -120,6 +121,8 @@ GIFLsb::gifLsbDecode(const DecodeOptions& args) noexcept {
             [&image, &pixelItr, &frame, &byteBuffer, &byteBufferSize, lsbLevel, mask]() -> uint8_t {
             while (byteBufferSize < 8) {
                 if (pixelItr == frame->buffer.end()) {
+                    // the decoder fills it again for a later frame
+                    BufferPool<PixelBGRA>::global().recycle(std::move(frame->buffer));
                     do {
                         frame = image->getNextFrame();
                     } while (!frame && !image->isEndOfStream());
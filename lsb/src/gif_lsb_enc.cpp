@@ -8,11 +8,13 @@
 #include <vector>
 
 #include "MimeTypes.h"
+#include "buffer_pool.h"
 #include "file_reader.h"
 #include "file_utils.h"
 #include "gif_encoder.h"
 #include "gif_exception.h"
 #include "gif_lsb.h"
+#include "gif_palette_planner.h"
 #include "imsq.h"
 #include "log.h"
 #include "mark.h"
@@ -98,14 +100,15 @@ quant(const ImageSequence::Ref& image,
             uint32_t endFrame   = startFrame + framePerThread;
             if (endFrame > frameCount) endFrame = frameCount;
             for (uint32_t j = startFrame; j < endFrame; ++j) {
-                auto frameBuffer = image->getFrameBuffer(j, width, height);
+                // given back once quantized, for the next frame of any thread
+                auto frameBuffer = BufferPool<PixelBGRA>::global().adopt(image->getFrameBuffer(j, width, height));
                 if (!markImage.empty()) {
-                    ImageSequence::drawMark(frameBuffer, width, height, markImage, markWidth, markHeight, 0, 0);
+                    ImageSequence::drawMark(*frameBuffer, width, height, markImage, markWidth, markHeight, 0, 0);
                 } else if (args.markText != "none") {
-                    ImageSequence::drawText(frameBuffer, width, height, args.markText);
+                    ImageSequence::drawText(*frameBuffer, width, height, args.markText);
                 }
                 {
-                    auto result = quantize(frameBuffer,
+                    auto result = quantize(*frameBuffer,
                                            width,
                                            height,
                                            numColors,
@@ -274,6 +277,33 @@ genPalettes(GetPaletteFunc& getPalette,
     return true;
 }
 
+// pick a global color table for the frames that can share one, if any
+static vector<PixelBGRA>
+planGlobalPalette(const GetPaletteFunc& getPalette,
+                  const uint32_t frameCount,
+                  const uint32_t width,
+                  const uint32_t height,
+                  const bool transparency,
+                  const uint32_t transparentIndex) {
+    GIFEnc::PalettePlanner planner(width, height, transparency, transparentIndex);
+    for (uint32_t i = 0; i < frameCount; ++i) {
+        if (const auto palette = getPalette(i)) {
+            // pixels carry file data, so every entry is considered used
+            planner.addFrame(*palette);
+        }
+    }
+    auto plan = planner.plan();
+    if (plan.globalColorTable.empty()) {
+        GeneralLogger::info("No global palette shared between frames.", GeneralLogger::STEP);
+    } else {
+        GeneralLogger::info("Global palette shared by " + std::to_string(plan.sharedFrames) + " of " +
+                                std::to_string(frameCount) + " frames, estimated saving: " +
+                                std::to_string(plan.estimatedSaving) + " bytes",
+                            GeneralLogger::STEP);
+    }
+    return std::move(plan.globalColorTable);
+}
+
 class LsbFileReader {
   public:
     LsbFileReader(const NaiveIO::FileReader::Ref& fileReader, const string& filePath, const uint32_t lsbLevel)
@@ -477,6 +507,15 @@ GIFLsb::gifLsbEncode(const EncodeOptions& args) noexcept {
             return false;
         }
 
+        vector<PixelBGRA> globalPalette;
+        if (args.enableLocalPalette) {
+            GeneralLogger::info("Planning palettes...");
+            globalPalette =
+                planGlobalPalette(getPalette, frameCount, width, height, args.transparency, (1 << minCodeLength) - 1);
+        } else {
+            globalPalette = *getPalette(0);
+        }
+
         GeneralLogger::info("Initializing GIF encoder...");
         GIFEncoder encoder(
             [&args](const std::span<const uint8_t> data) -> bool {
@@ -499,8 +538,8 @@ GIFLsb::gifLsbEncode(const EncodeOptions& args) noexcept {
             args.transparency,
             (1 << minCodeLength) - 1,
             0,
-            !args.enableLocalPalette,
-            args.enableLocalPalette ? vector<PixelBGRA>{} : *getPalette(0));
+            !globalPalette.empty(),
+            globalPalette);
 
         GeneralLogger::info("Generating frames...");
         uint32_t frameIndex      = 0;
@@ -46,6 +46,10 @@ GIFLsb::DecodeOptions::parseArgs(int argc, char** argv) noexcept {
          "Output directory. If not given, the output file will be saved in the current directory.",
          cxxopts::value<string>())
         //
+        ("decoder-threads",
+         "Number of threads to decode a video image with, 0 means auto-detect.",
+         cxxopts::value<uint32_t>()->default_value("0"))
+        //
         ("h,help", "Show help message");
 
     options.positional_help("<image>");
@@ -63,8 +67,11 @@ GIFLsb::DecodeOptions::parseArgs(int argc, char** argv) noexcept {
         }
 
         DecodeOptions gifOptions;
+        gifOptions.readOptions.decoderThreads = result["decoder-threads"].as<uint32_t>();
+
         gifOptions.imagePath       = result["image"].as<string>();
-        gifOptions.image           = GIFImage::ImageSequenceStream::read(gifOptions.imagePath);
+        gifOptions.image           = GIFImage::ImageSequenceStream::prefetch(
+            GIFImage::ImageSequenceStream::read(gifOptions.imagePath, gifOptions.readOptions));
         gifOptions.outputName      = result.count("name") ? result["name"].as<string>() : "";
         gifOptions.outputDirectory = result.count("directory") ? result["directory"].as<string>() : ".";
         gifOptions.tempFileName    = genTempName();
@@ -70,6 +70,14 @@ EncodeOptions::parseArgs(int argc, char** argv) noexcept {
          "Number of threads to use for processing, 0 means auto-detect.",
          cxxopts::value<uint32_t>()->default_value(std::to_string(Defaults::THREAD_COUNT)))
         //
+        ("max-frame-cache-mb",
+         "Memory budget in MB for the decoded frames of the image, 0 means unlimited.",
+         cxxopts::value<uint32_t>()->default_value(std::to_string(GIFImage::ReadOptions::DEFAULT_MAX_FRAME_CACHE_MB)))
+        //
+        ("decoder-threads",
+         "Number of threads to decode a video image with, 0 means auto-detect.",
+         cxxopts::value<uint32_t>()->default_value("0"))
+        //
         ("h,help", "Show help message");
 
     options.positional_help("<image> <encrypt-file>");
@@ -88,8 +96,11 @@ EncodeOptions::parseArgs(int argc, char** argv) noexcept {
         }
 
         EncodeOptions gifOptions;
+        gifOptions.readOptions.maxFrameCacheMB = result["max-frame-cache-mb"].as<uint32_t>();
+        gifOptions.readOptions.decoderThreads  = result["decoder-threads"].as<uint32_t>();
+
         gifOptions.imagePath            = result["image"].as<string>();
-        gifOptions.image                = GIFImage::ImageSequence::read(gifOptions.imagePath);
+        gifOptions.image                = GIFImage::ImageSequence::read(gifOptions.imagePath, gifOptions.readOptions);
         gifOptions.filePath             = result["file"].as<string>();
         gifOptions.file                 = NaiveIO::FileReader::create(gifOptions.filePath);
         gifOptions.outputPath           = result["output"].as<string>();
@@ -8,6 +8,14 @@ namespace GIFMirage {
 bool
 gifMirageEncode(const GIFMirage::Options& args);
 
+/**
+ * @brief Run every job of a manifest on one thread pool.
+ *        Prepared sources are shared between jobs through a bounded cache.
+ * @return false if any job failed.
+ */
+bool
+gifMirageBatch(const GIFMirage::BatchOptions& batch);
+
 };
 
 #endif  // GIF_MIRAGE_INTERFACE_H
\ No newline at end of file
@@ -2,8 +2,10 @@
 #define GIFMIRAGE_GIF_OPTIONS_H
 
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "file_writer.h"
 #include "imsq.h"
@@ -30,7 +32,8 @@ class Options {
         "  S: Slope, [0, 4]\n"
         "  W: Width, [1, 4]\n"
         "  C/R: Direction, Column/Row\n"
-        "  (e.g. S2W1R = Slope 1, Width 2, Row)";
+        "  (e.g. S2W1R = Slope 1, Width 2, Row)\n"
+        "  Several comma separated modes generate one GIF each.";
 
   public:
     struct Defaults {
@@ -52,28 +55,73 @@ class Options {
         static constexpr uint32_t modeSlope      = 4;
         static constexpr uint32_t modeWidth      = 4;
         static constexpr uint32_t disposalMethod = 3;
+        static constexpr uint32_t variants       = 64;
     };
 
-    GIFImage::ImageSequence::Ref innerImage;
-    GIFImage::ImageSequence::Ref coverImage;
+    // one generated GIF, variants share the inputs, the timeline and the prepared source frames
+    struct Variant {
+        MergeMode mergeMode;
+        uint32_t width  = Defaults::width;
+        uint32_t height = Defaults::height;
+        std::string outputPath;
+        NaiveIO::FileWriter::Ref outputFile;  // nullptr until written if files are opened lazily
+    };
+
+    // shared so that batch jobs can use the same decoded sources
+    std::shared_ptr<GIFImage::ImageSequence> innerImage;
+    std::shared_ptr<GIFImage::ImageSequence> coverImage;
     std::string innerPath;
     std::string coverPath;
-    NaiveIO::FileWriter::Ref outputFile;
-    std::string outputPath = Defaults::outputPath;
-    uint32_t width         = Defaults::width;
-    uint32_t height        = Defaults::height;
-    uint32_t frameCount    = Defaults::frameCount;
-    uint32_t delay         = Defaults::delay;
-    MergeMode mergeMode;
+    GIFImage::ReadOptions readOptions;
+    std::vector<Variant> variants;  // every merge mode at every size
+    std::string outputPath  = Defaults::outputPath;
+    uint32_t frameCount     = Defaults::frameCount;
+    uint32_t delay          = Defaults::delay;
     uint32_t threadCount    = Defaults::threadCount;
     uint32_t disposalMethod = Defaults::disposalMethod;
 
   public:
+    /**
+     * @brief Parse the command line of a single job.
+     * @param openFiles Whether to read the inputs and create the outputs right away,
+     *                  otherwise only the paths are set.
+     */
     static std::optional<Options>
-    parseArgs(int argc, char** argv) noexcept;
+    parseArgs(int argc, char** argv, bool openFiles = true) noexcept;
 
     void
-    ensureValid() const;
+    ensureValid(bool openFiles = true) const;
+};
+
+class BatchOptions {
+  public:
+    struct Defaults {
+        static constexpr uint32_t threadCount     = 0;  // 0 means auto-detect
+        static constexpr uint32_t cacheSize       = 16;
+        static constexpr uint32_t maxFrameCacheMB = 1024;
+    };
+
+    std::string manifestPath;
+    std::vector<Options> jobs;  // inputs and outputs are not opened yet
+    uint32_t threadCount     = Defaults::threadCount;
+    uint32_t cacheSize       = Defaults::cacheSize;        // prepared sources kept between jobs
+    uint32_t maxFrameCacheMB = Defaults::maxFrameCacheMB;  // for the decoded frames of all jobs together
+
+    /**
+     * @brief Whether the command line asks for batch mode (--batch).
+     */
+    static bool
+    isBatch(int argc, char** argv) noexcept;
+
+    /**
+     * @brief Parse the batch command line and the manifest it points to.
+     *        Each non-empty manifest line not starting with '#' holds the arguments of one job,
+     *        as they would be given on the command line. Double quotes group arguments with spaces.
+     *        The thread count and the frame cache budget are set for the whole batch, not per job,
+     *        and no two jobs may write the same output.
+     */
+    static std::optional<BatchOptions>
+    parseArgs(int argc, char** argv) noexcept;
 };
 }  // namespace GIFMirage
 
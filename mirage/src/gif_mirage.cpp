@@ -1,31 +1,247 @@
 #include "gif_mirage.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <exception>
 #include <functional>
+#include <list>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <numeric>
 #include <span>
 #include <string>
-#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "buffer_pool.h"
 #include "def.h"
 #include "dither.h"
+#include "file_writer.h"
 #include "gif_encoder.h"
 #include "gif_lzw.h"
 #include "gif_options.h"
 #include "imsq.h"
 #include "log.h"
+#include "task_pool.h"
 
 using std::vector, std::string, std::array, std::span;
 
-using IsCoverFunc = std::function<bool(uint32_t x, uint32_t y)>;
-
 static const vector<PixelBGRA> GCT{makeBGRA(0, 0, 0), makeBGRA(0x80, 0x80, 0x80), makeBGRA(0xff, 0xff, 0xff)};
-static constexpr uint32_t TRANSPARENT_INDEX = 1;
-static constexpr uint32_t MIN_CODE_LENGTH   = 2;
-static const auto ditherFunc                = ImageSequence::Dither::BayerOrderedDithering<4>::orderedDithering;
+static constexpr uint32_t TRANSPARENT_INDEX  = 1;
+static constexpr uint32_t MIN_CODE_LENGTH    = 2;
+static constexpr uint32_t PREPARE_RUN_LENGTH = 8;  // most consecutive source frames prepared by one task
+using Dithering                              = ImageSequence::Dither::BayerOrderedDithering<4>;
+using LumaPool                               = GIFImage::BufferPool<uint8_t>;
+
+// 1 bit per pixel, rows padded to whole 64 bit words, lowest bit first
+struct BitPlane {
+    uint32_t stride = 0;  // words per row
+    vector<uint64_t> words;
+
+    BitPlane(const uint32_t width, const uint32_t height)
+        : stride((width + 63) / 64), words(static_cast<size_t>(stride) * height) {}
+
+    [[nodiscard]] uint64_t*
+    getRow(const uint32_t y) {
+        return words.data() + static_cast<size_t>(y) * stride;
+    }
+
+    [[nodiscard]] const uint64_t*
+    getRow(const uint32_t y) const {
+        return words.data() + static_cast<size_t>(y) * stride;
+    }
+};
+
+// byte k of each entry is bit k of its index, so 8 bits expand to 8 bytes at once
+static constexpr auto BIT_EXPAND = []() {
+    std::array<uint64_t, 256> ret{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        std::array<uint8_t, 8> bytes{};
+        for (uint32_t k = 0; k < 8; ++k) {
+            bytes[k] = (i >> k) & 1;
+        }
+        ret[i] = std::bit_cast<uint64_t>(bytes);
+    }
+    return ret;
+}();
+
+// whether the cover image shows at (x, y)
+static bool
+isCover(const GIFMirage::MergeMode& mode, const uint32_t x, const uint32_t y) {
+    if (!mode.slope) {
+        return (mode.isRow ? y : x) % (mode.width * 2) < mode.width;
+    } else if (mode.isRow) {
+        return (y / mode.slope + x) % (mode.width * 2) < mode.width;
+    } else {
+        return (x / mode.slope + y) % (mode.width * 2) < mode.width;
+    }
+}
+
+// the merge pattern is periodic in y, so every row is one of at most (2 * width) distinct masks.
+// bits are set where the cover image shows.
+class CoverMask {
+  public:
+    CoverMask(const GIFMirage::MergeMode& mode, const uint32_t width, const uint32_t height)
+        : m_rowMasks(height) {
+        const uint32_t period = mode.width * 2;
+        const uint32_t stride = (width + 63) / 64;
+        vector<uint32_t> phaseMasks(period, UINT32_MAX);
+        for (uint32_t y = 0; y < height; ++y) {
+            const uint32_t phase = (mode.isRow && mode.slope ? y / mode.slope : y) % period;
+            if (phaseMasks[phase] == UINT32_MAX) {
+                phaseMasks[phase] = m_masks.size();
+                auto& mask        = m_masks.emplace_back(stride);
+                for (uint32_t x = 0; x < width; ++x) {
+                    mask[x / 64] |= static_cast<uint64_t>(isCover(mode, x, y)) << (x % 64);
+                }
+            }
+            m_rowMasks[y] = phaseMasks[phase];
+        }
+    }
+
+    [[nodiscard]] const uint64_t*
+    getRow(const uint32_t y) const {
+        return m_masks[m_rowMasks[y]].data();
+    }
+
+  private:
+    vector<vector<uint64_t>> m_masks;
+    vector<uint32_t> m_rowMasks;  // index in m_masks of each row
+};
+
+// merge a row of the dithered planes into palette indexes:
+// 1 (transparent) where the shown image is bright on the cover or dark on the inner part,
+// 0 for dark cover pixels, 2 for bright inner pixels.
+// with m the mask and p the shown bit, the index is lo | hi << 1 where
+// lo = (m & p) | (~m & ~p), hi = ~m & p
+static void
+mergeRow(uint8_t* out, const uint64_t* inner, const uint64_t* cover, const uint64_t* mask, const uint32_t width) {
+    for (uint32_t x = 0; x < width; x += 64) {
+        const uint64_t m  = *mask++;
+        const uint64_t p  = (m & *cover++) | (~m & *inner++);
+        const uint64_t lo = ~(m ^ p);
+        const uint64_t hi = ~m & p;
+        const uint32_t n  = std::min<uint32_t>(64, width - x);
+        for (uint32_t k = 0; k < n; k += 8) {
+            const uint64_t bytes = BIT_EXPAND[(lo >> k) & 0xff] | (BIT_EXPAND[(hi >> k) & 0xff] << 1);
+            std::memcpy(out + x + k, &bytes, std::min<uint32_t>(8, n - k));
+        }
+    }
+}
+
+// dithered frames of a source, each one prepared at most once when first requested.
+// different frames are prepared concurrently, a thread only waits for the frame it asked for.
+// frames prepared in order by prepare() are derived from the previous one where the source did not change,
+// identical frames share the same plane.
+class DitheredFrameCache {
+  public:
+    DitheredFrameCache(std::shared_ptr<GIFImage::ImageSequence> image, const uint32_t width, const uint32_t height)
+        : m_image(std::move(image)), m_width(width), m_height(height), m_entries(m_image->getFrameCount()) {}
+
+    [[nodiscard]] GIFImage::ImageSequence&
+    getImage() const {
+        return *m_image;
+    }
+
+    [[nodiscard]] const std::shared_ptr<GIFImage::ImageSequence>&
+    shareImage() const {
+        return m_image;
+    }
+
+    // nullptr if the frame could not be read
+    [[nodiscard]] const BitPlane*
+    get(const uint32_t index) {
+        auto& entry = m_entries[index];
+        std::call_once(entry.once, [this, index, &entry]() {
+            const auto luma = LumaPool::global().adopt(m_image->getFrameLuma(index, m_width, m_height));
+            if (luma->empty()) return;
+            entry.frame = dither(*luma);
+        });
+        return entry.frame.get();
+    }
+
+    /**
+     * @brief Prepare the frames [first, last] in order.
+     *        A frame the source reports unchanged shares the plane of the previous one,
+     *        otherwise only the 64 pixel tiles whose luma changed are dithered again.
+     */
+    void
+    prepare(const uint32_t first, const uint32_t last) {
+        LumaPool::Handle previousLuma;  // of the previous frame, empty if unknown
+        std::shared_ptr<const BitPlane> previousFrame;
+        for (uint32_t index = first; index <= last; ++index) {
+            auto& entry   = m_entries[index];
+            bool prepared = false;
+            std::call_once(entry.once, [&]() {
+                prepared = true;
+                if (previousFrame && m_image->isSameAsPrevious(index)) {
+                    entry.frame = previousFrame;
+                    return;
+                }
+                auto luma = LumaPool::global().adopt(m_image->getFrameLuma(index, m_width, m_height));
+                if (luma->empty()) return;
+                entry.frame  = previousFrame && !previousLuma->empty() ? ditherChanged(*luma, *previousLuma, previousFrame)
+                                                                       : dither(*luma);
+                previousLuma = std::move(luma);
+            });
+            if (!prepared) {
+                previousLuma.reset();
+            }
+            // complete once call_once returned, whoever prepared it
+            previousFrame = entry.frame;
+        }
+    }
+
+  private:
+    struct Entry {
+        std::once_flag once;
+        std::shared_ptr<const BitPlane> frame;
+    };
+
+    [[nodiscard]] std::shared_ptr<const BitPlane>
+    dither(const vector<uint8_t>& luma) const {
+        auto frame = std::make_shared<BitPlane>(m_width, m_height);
+        for (uint32_t y = 0; y < m_height; ++y) {
+            Dithering::ditherRowBits(frame->getRow(y), luma.data() + static_cast<size_t>(y) * m_width, m_width, y);
+        }
+        return frame;
+    }
+
+    // ordered dithering has no error diffusion, so a tile with the same luma has the same bits
+    [[nodiscard]] std::shared_ptr<const BitPlane>
+    ditherChanged(const vector<uint8_t>& luma,
+                  const vector<uint8_t>& previousLuma,
+                  const std::shared_ptr<const BitPlane>& previousFrame) const {
+        std::shared_ptr<BitPlane> frame;
+        for (uint32_t y = 0; y < m_height; ++y) {
+            const uint8_t* row         = luma.data() + static_cast<size_t>(y) * m_width;
+            const uint8_t* previousRow = previousLuma.data() + static_cast<size_t>(y) * m_width;
+            for (uint32_t x = 0; x < m_width; x += 64) {
+                const uint32_t n = std::min<uint32_t>(64, m_width - x);
+                if (std::memcmp(row + x, previousRow + x, n) == 0) continue;
+                if (!frame) frame = std::make_shared<BitPlane>(*previousFrame);
+                Dithering::ditherRowBits(frame->getRow(y) + x / 64, row + x, n, y);
+            }
+        }
+        if (!frame) {
+            return previousFrame;
+        }
+        return frame;
+    }
+
+    std::shared_ptr<GIFImage::ImageSequence> m_image;
+    uint32_t m_width  = 0;
+    uint32_t m_height = 0;
+    vector<Entry> m_entries;
+};
 
 static vector<uint32_t>
 getFrameIndices(const vector<uint32_t>& delays, const uint32_t targetDelay, const uint32_t targetNumFrames) {
@@ -65,183 +281,87 @@ getFrameIndices(const vector<uint32_t>& delays, const uint32_t targetDelay, cons
     return ret;
 }
 
-bool
-GIFMirage::gifMirageEncode(const GIFMirage::Options& args) {
-    GeneralLogger::info("Starting GIF mirage encoding...");
-    GeneralLogger::info("Output file: " + args.outputFile->getFilePath(), GeneralLogger::STEP);
-    GeneralLogger::info("Width: " + std::to_string(args.width), GeneralLogger::STEP);
-    GeneralLogger::info("Height: " + std::to_string(args.height), GeneralLogger::STEP);
-    GeneralLogger::info("Number of frames: " + std::to_string(args.frameCount), GeneralLogger::STEP);
-    GeneralLogger::info("Frame duration: " + std::to_string(args.delay), GeneralLogger::STEP);
-    GeneralLogger::info("Merge mode: " + args.mergeMode.toString(), GeneralLogger::STEP);
+namespace {
+// output frames showing the same (inner, cover) pair are identical, so each pair is generated once
+struct Timeline {
+    vector<uint32_t> pairInnerIndices;
+    vector<uint32_t> pairCoverIndices;
+    vector<uint32_t> framePairs;  // output frame -> pair
+};
+}  // namespace
 
-    auto& inner = args.innerImage;
-    auto& cover = args.coverImage;
-    if (!inner || !cover) {
-        return false;
+static Timeline
+makeTimeline(const vector<uint32_t>& innerIndices, const vector<uint32_t>& coverIndices) {
+    Timeline timeline;
+    timeline.framePairs.resize(innerIndices.size());
+    std::unordered_map<uint64_t, uint32_t> pairs;
+    for (size_t j = 0; j < innerIndices.size(); ++j) {
+        const uint64_t key        = (static_cast<uint64_t>(innerIndices[j]) << 32) | coverIndices[j];
+        const auto [it, inserted] = pairs.try_emplace(key, static_cast<uint32_t>(timeline.pairInnerIndices.size()));
+        if (inserted) {
+            timeline.pairInnerIndices.push_back(innerIndices[j]);
+            timeline.pairCoverIndices.push_back(coverIndices[j]);
+        }
+        timeline.framePairs[j] = it->second;
     }
-    const auto innerIndices =
-        getFrameIndices(inner->getDelays(), args.delay, args.frameCount);
-    const auto coverIndices =
-        getFrameIndices(cover->getDelays(), args.delay, args.frameCount);
+    return timeline;
+}
 
-    GeneralLogger::info("Generating frames...");
-    uint8_t** innerFramesCache = new uint8_t* [inner->getFrameCount()] {
-        nullptr
-    };  // GrayScale
-    std::mutex innerMutex;
-    uint8_t** coverFramesCache = new uint8_t* [cover->getFrameCount()] {
-        nullptr
-    };  // GrayScale
-    std::mutex coverMutex;
-    vector<vector<uint8_t>> outFrames(args.frameCount);  // GrayScale
-    std::mutex cntMutex;
-    uint32_t cnt = 0;
-
-    const auto framesPerThread = (args.frameCount + args.threadCount - 1) / args.threadCount;
-    GeneralLogger::info(std::string("Thread count: ") + std::to_string(args.threadCount), GeneralLogger::STEP);
-    auto threads = vector<std::thread>(args.threadCount);
-
-    const IsCoverFunc isCoverFunc = std::bind(
-        [](const uint32_t slope, const uint32_t width, const bool isRow, const uint32_t x, const uint32_t y) {
-            if (!slope) {
-                return (isRow ? y : x) % (width * 2) < width;
-            } else if (isRow) {
-                return (y / slope + x) % (width * 2) < width;
+// merge two dithered frames and compress the result into GIF sub-blocks, empty on failure
+static vector<uint8_t>
+compressFrame(const BitPlane& innerFrame,
+              const BitPlane& coverFrame,
+              const CoverMask& coverMask,
+              const uint32_t width,
+              const uint32_t height) {
+    vector<uint8_t> merged(static_cast<size_t>(width) * height);
+    for (uint32_t y = 0; y < height; ++y) {
+        mergeRow(merged.data() + static_cast<size_t>(y) * width,
+                 innerFrame.getRow(y),
+                 coverFrame.getRow(y),
+                 coverMask.getRow(y),
+                 width);
+    }
+
+    vector<uint8_t> outData;
+    bool isFirst              = true;
+    const auto compressedSize = GIFEnc::LZW::compressStream(
+        [&merged, &isFirst]() -> std::span<const uint8_t> {
+            if (isFirst) {
+                isFirst = false;
+                return {merged.data(), merged.size()};
             } else {
-                return (x / slope + y) % (width * 2) < width;
+                return {};
             }
         },
-        args.mergeMode.slope,
-        args.mergeMode.width,
-        args.mergeMode.isRow,
-        std::placeholders::_1,
-        std::placeholders::_2);
-
-    for (uint32_t i = 0; i < args.threadCount; ++i) {
-        threads[i] = std::thread(
-            [&args,
-             &innerFramesCache,
-             &coverFramesCache,
-             &innerMutex,
-             &coverMutex,
-             &innerIndices,
-             &coverIndices,
-             &isCoverFunc,
-             &inner,
-             &cover,
-             &outFrames,
-             &cnt,
-             &cntMutex](uint32_t start, uint32_t end) {
-                for (uint32_t j = start; j < end; ++j) {
-                    uint8_t* innerFrame;
-                    uint8_t* coverFrame;
-                    {
-                        std::lock_guard<std::mutex> lock(innerMutex);
-                        innerFrame = innerFramesCache[innerIndices[j]];
-                        if (!innerFrame) {
-                            const auto frameBuffer =
-                                inner->getFrameBuffer(innerIndices[j], args.width, args.height);
-                            if (frameBuffer.empty()) return;
-                            innerFrame = new uint8_t[args.width * args.height];
-                            ditherFunc(innerFrame, frameBuffer.data(), args.width, args.height);
-                            innerFramesCache[innerIndices[j]] = innerFrame;
-                        }
-                    }
-                    {
-                        std::lock_guard<std::mutex> lock(coverMutex);
-                        coverFrame = coverFramesCache[coverIndices[j]];
-                        if (!coverFrame) {
-                            const auto frameBuffer =
-                                cover->getFrameBuffer(coverIndices[j], args.width, args.height);
-                            if (frameBuffer.empty()) return;
-                            coverFrame = new uint8_t[args.width * args.height];
-                            ditherFunc(coverFrame, frameBuffer.data(), args.width, args.height);
-                            coverFramesCache[coverIndices[j]] = coverFrame;
-                        }
-                    }
-                    std::array pixels = {
-                        innerFrame,
-                        coverFrame,
-                    };
-                    uint64_t size = args.width * args.height;
-                    vector<uint8_t> merged(size);
-                    for (uint32_t x = 0; x < args.width; ++x) {
-                        for (uint32_t y = 0; y < args.height; ++y) {
-                            int i        = y * args.width + x;
-                            bool isCover = isCoverFunc(x, y);
-                            if ((pixels[isCover][i] > 128) == isCover) {
-                                merged[i] = 1;
-                            } else if (isCover) {
-                                merged[i] = 0;
-                            } else {
-                                merged[i] = 2;
-                            }
-                        }
-                    }
-
-                    vector<uint8_t> outData;
-                    bool isFirst              = true;
-                    const auto compressedSize = GIFEnc::LZW::compressStream(
-                        [&merged, &isFirst]() -> std::span<const uint8_t> {
-                            if (isFirst) {
-                                isFirst = false;
-                                return {merged.data(), merged.size()};
-                            } else {
-                                return {};
-                            }
-                        },
-                        [&outData](const std::span<const uint8_t>& data) {
-                            if (data.empty()) return;
-                            outData.push_back(data.size());
-                            outData.insert(outData.end(), data.begin(), data.end());
-                        },
-                        nullptr,
-                        MIN_CODE_LENGTH,
-                        255);
-                    if (compressedSize == 0) {
-                        GeneralLogger::error("Failed to compress frame data.");
-                        return;
-                    }
-                    outData.push_back(0);
-                    outFrames[j] = std::move(outData);
-                    {
-                        std::lock_guard<std::mutex> lock(cntMutex);
-                        if (++cnt % 10 == 0) {
-                            GeneralLogger::info(
-                                std::to_string(cnt) + " of " + std::to_string(args.frameCount) + " frames processed.",
-                                GeneralLogger::STEP);
-                        }
-                    }
-                }
-            },
-            i * framesPerThread,
-            std::min<uint32_t>((i + 1) * framesPerThread, args.frameCount));
-    }
-
-    for (auto& thread : threads) {
-        if (thread.joinable()) {
-            thread.join();
-        }
-    }
-
-    for (uint32_t i = 0; i < inner->getFrameCount(); ++i) {
-        delete[] innerFramesCache[i];
-    }
-    delete[] innerFramesCache;
-    for (uint32_t i = 0; i < cover->getFrameCount(); ++i) {
-        delete[] coverFramesCache[i];
+        [&outData](const std::span<const uint8_t>& data) {
+            if (data.empty()) return;
+            outData.push_back(data.size());
+            outData.insert(outData.end(), data.begin(), data.end());
+        },
+        nullptr,
+        MIN_CODE_LENGTH,
+        255);
+    if (compressedSize == 0) {
+        GeneralLogger::error("Failed to compress frame data.");
+        return {};
     }
-    delete[] coverFramesCache;
-
-    GeneralLogger::info("Writing GIF...");
+    outData.push_back(0);
+    return outData;
+}
 
+static bool
+writeGIF(const GIFMirage::Options& args,
+         const GIFMirage::Options::Variant& variant,
+         NaiveIO::FileWriter& outputFile,
+         const vector<vector<uint8_t>>& pairFrames,
+         const vector<uint32_t>& framePairs) {
     GIFEnc::GIFEncoder* encoder = nullptr;
     try {
         encoder = new GIFEnc::GIFEncoder(
-            [&args](const span<const uint8_t> data) -> bool {
+            [&outputFile](const span<const uint8_t> data) -> bool {
                 try {
-                    if (args.outputFile->write(data) != data.size()) {
+                    if (outputFile.write(data) != data.size()) {
                         return false;
                     }
                     return true;
@@ -252,8 +372,8 @@ GIFMirage::gifMirageEncode(const GIFMirage::Options& args) {
                 }
                 return false;
             },
-            args.width,
-            args.height,
+            variant.width,
+            variant.height,
             TRANSPARENT_INDEX,
             MIN_CODE_LENGTH,
             true,
@@ -261,18 +381,24 @@ GIFMirage::gifMirageEncode(const GIFMirage::Options& args) {
             0,
             true,
             GCT);
+        // consecutive frames of the same pair are merged into one with a longer delay
+        encoder->enableFrameCoalescing();
 
-        for (uint32_t i = 0; i < args.frameCount; ++i) {
-            if (outFrames[i].empty()) continue;
-            encoder->addFrameCompressed(outFrames[i], args.delay, args.disposalMethod);
+        for (const auto pair : framePairs) {
+            const auto& frame = pairFrames[pair];
+            if (frame.empty()) continue;
+            encoder->addFrameCompressed(frame, args.delay, args.disposalMethod);
         }
         if (!encoder->finish()) {
             GeneralLogger::error("Failed to write GIF file.");
             delete encoder;
             return false;
         }
-        args.outputFile->close();
-        GeneralLogger::info("Output file: " + args.outputFile->getFilePath());
+        if (const auto coalesced = encoder->getCoalescedFrames()) {
+            GeneralLogger::info("Merged " + std::to_string(coalesced) + " repeated frames.", GeneralLogger::STEP);
+        }
+        outputFile.close();
+        GeneralLogger::info("Output file: " + outputFile.getFilePath());
         delete encoder;
         return true;
     } catch (const std::exception& e) {
@@ -280,8 +406,441 @@ GIFMirage::gifMirageEncode(const GIFMirage::Options& args) {
     } catch (...) {
         GeneralLogger::error("Failed to write GIF file: unknown error");
     }
-    args.outputFile->close();
-    args.outputFile->deleteFile();
+    outputFile.close();
+    outputFile.deleteFile();
     delete encoder;
     return false;
-}
\ No newline at end of file
+}
+
+// dithered sources keyed by path and size, shared by all variants and jobs using them.
+// beyond the capacity the least recently used ones are dropped, they stay alive while a job still holds them.
+// the decoder of a file is closed while no job reads it.
+class SourceCache {
+  public:
+    explicit SourceCache(const size_t capacity)
+        : m_capacity(capacity) {}
+
+    /**
+     * @brief Get the dithered frames of a source at the given size.
+     * @param image The decoded source, if null the file is read when first needed.
+     * @param readOptions How to read the file if needed.
+     * @return nullptr if the source cannot be read, to be given back with release otherwise.
+     */
+    [[nodiscard]] std::shared_ptr<DitheredFrameCache>
+    get(const string& path,
+        const std::shared_ptr<GIFImage::ImageSequence>& image,
+        const uint32_t width,
+        const uint32_t height,
+        const GIFImage::ReadOptions& readOptions) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const string key = path + '\n' + std::to_string(width) + 'x' + std::to_string(height);
+            const auto it    = m_index.find(key);
+            if (it != m_index.end()) {
+                m_entries.splice(m_entries.begin(), m_entries, it->second);
+                entry = *it->second;
+                ++m_hits;
+            } else {
+                entry      = std::make_shared<Entry>();
+                entry->key = key;
+                m_entries.push_front(entry);
+                m_index.emplace(key, m_entries.begin());
+                if (m_entries.size() > m_capacity) {
+                    m_index.erase(m_entries.back()->key);
+                    m_entries.pop_back();
+                }
+                ++m_misses;
+            }
+        }
+        // outside of the lock, other sources can be prepared meanwhile
+        std::call_once(entry->once, [this, &entry, &path, &image, width, height, &readOptions]() {
+            auto source = image ? image : readImage(path, readOptions);
+            if (source) {
+                entry->frames = std::make_shared<DitheredFrameCache>(std::move(source), width, height);
+            }
+        });
+        if (entry->frames) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_readers[&entry->frames->getImage()];
+        }
+        return entry->frames;
+    }
+
+    /**
+     * @brief A job is done with the frames returned by get.
+     *        Once no job reads the file anymore its decoder is closed, the dithered frames are kept.
+     */
+    void
+    release(const std::shared_ptr<GIFImage::ImageSequence>& image) noexcept {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const auto it = m_readers.find(image.get());
+            if (it == m_readers.end() || --it->second > 0) {
+                return;
+            }
+            m_readers.erase(it);
+        }
+        // a job starting on it meanwhile only has to reopen it
+        image->releaseDecoder();
+    }
+
+    [[nodiscard]] size_t
+    getHits() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hits;
+    }
+
+    [[nodiscard]] size_t
+    getMisses() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_misses;
+    }
+
+  private:
+    struct Entry {
+        string key;
+        std::once_flag once;
+        std::shared_ptr<DitheredFrameCache> frames;
+    };
+
+    // a file used at several sizes is only decoded once while any of them is alive
+    std::shared_ptr<GIFImage::ImageSequence>
+    readImage(const string& path, const GIFImage::ReadOptions& readOptions) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const auto it = m_images.find(path);
+            if (it != m_images.end()) {
+                if (auto image = it->second.lock()) return image;
+            }
+        }
+        std::shared_ptr<GIFImage::ImageSequence> image = GIFImage::ImageSequence::read(path, readOptions);
+        if (image) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_images[path] = image;
+        }
+        return image;
+    }
+
+    size_t m_capacity = 0;
+    mutable std::mutex m_mutex;
+    std::list<std::shared_ptr<Entry>> m_entries;  // most recently used first
+    std::unordered_map<string, std::list<std::shared_ptr<Entry>>::iterator> m_index;
+    std::unordered_map<string, std::weak_ptr<GIFImage::ImageSequence>> m_images;
+    std::unordered_map<const GIFImage::ImageSequence*, size_t> m_readers;  // jobs reading each file
+    size_t m_hits   = 0;
+    size_t m_misses = 0;
+};
+
+// all variants of one set of options, run as tasks of a shared pool.
+// the tasks keep the job alive, the callback is invoked once every output has been written.
+class MirageJob : public std::enable_shared_from_this<MirageJob> {
+  public:
+    using DoneCallback = std::function<void(bool)>;
+
+    MirageJob(const GIFMirage::Options& args, SourceCache& cache, TaskPool& pool, const bool verbose, DoneCallback onDone)
+        : m_args(args), m_cache(cache), m_pool(pool), m_verbose(verbose), m_onDone(std::move(onDone)) {}
+
+    // get the sources and queue the frames of every variant
+    void
+    start() noexcept {
+        try {
+            for (const auto& variant : m_args.variants) {
+                auto& output    = m_outputs.emplace_back(std::make_unique<Output>(variant));
+                const auto same = std::find_if(m_outputs.begin(), m_outputs.end() - 1, [&variant](const auto& other) {
+                    return other->variant.width == variant.width && other->variant.height == variant.height;
+                });
+                // variants of the same size share their sources regardless of the cache capacity
+                if (same != m_outputs.end() - 1) {
+                    output->inner = (*same)->inner;
+                    output->cover = (*same)->cover;
+                    continue;
+                }
+                output->inner = m_cache.get(m_args.innerPath, m_args.innerImage, variant.width, variant.height, m_args.readOptions);
+                output->cover = m_cache.get(m_args.coverPath, m_args.coverImage, variant.width, variant.height, m_args.readOptions);
+                if (output->inner) m_sources.push_back(output->inner->shareImage());
+                if (output->cover) m_sources.push_back(output->cover->shareImage());
+                if (!output->inner || !output->cover) {
+                    GeneralLogger::error("Failed to read " + (output->inner ? m_args.coverPath : m_args.innerPath));
+                    releaseSources();
+                    m_onDone(false);
+                    return;
+                }
+            }
+            auto& innerImage = m_outputs.front()->inner->getImage();
+            auto& coverImage = m_outputs.front()->cover->getImage();
+            m_timeline       = makeTimeline(getFrameIndices(innerImage.getDelays(), m_args.delay, m_args.frameCount),
+                                      getFrameIndices(coverImage.getDelays(), m_args.delay, m_args.frameCount));
+        } catch (const std::exception& e) {
+            GeneralLogger::error(std::string("Failed to start job: ") + e.what());
+            releaseSources();
+            m_onDone(false);
+            return;
+        }
+
+        const auto pairCount = static_cast<uint32_t>(m_timeline.pairInnerIndices.size());
+        if (m_verbose) {
+            GeneralLogger::info("Distinct frames: " + std::to_string(pairCount), GeneralLogger::STEP);
+        }
+        m_remainingOutputs = m_outputs.size();
+        for (auto& output : m_outputs) {
+            output->frames.resize(pairCount);
+            output->sameAs.resize(pairCount);
+            std::iota(output->sameAs.begin(), output->sameAs.end(), 0);
+            output->remaining = pairCount;
+        }
+
+        const auto self = shared_from_this();
+        // source frames are prepared by their own tasks, queued ahead of the frames using them,
+        // so the first touch of an expensive source frame does not stall a whole range of output frames
+        vector<const DitheredFrameCache*> submittedCaches;
+        const auto submitSourceFrames = [this, &self, &submittedCaches](const std::shared_ptr<DitheredFrameCache>& cache,
+                                                                        const vector<uint32_t>& indices) {
+            if (std::find(submittedCaches.begin(), submittedCaches.end(), cache.get()) != submittedCaches.end()) {
+                return;
+            }
+            submittedCaches.push_back(cache.get());
+            vector<bool> needed;
+            for (const auto index : indices) {
+                if (index >= needed.size()) needed.resize(index + 1, false);
+                needed[index] = true;
+            }
+            // only these are decoded from sources that decode on demand, such as long videos
+            vector<uint32_t> requested;
+            for (uint32_t index = 0; index < needed.size(); ++index) {
+                if (needed[index]) requested.push_back(index);
+            }
+            cache->getImage().requestFrames(requested);
+            // runs of consecutive frames are prepared in order so that each can reuse the previous one,
+            // split to keep enough tasks for all threads
+            for (uint32_t first = 0; first < needed.size(); ++first) {
+                if (!needed[first]) continue;
+                uint32_t last = first;
+                while (last + 1 < needed.size() && needed[last + 1] && last + 1 - first < PREPARE_RUN_LENGTH) {
+                    ++last;
+                }
+                m_pool.submit([self, cache, first, last]() { cache->prepare(first, last); });
+                first = last;
+            }
+        };
+        for (const auto& output : m_outputs) {
+            submitSourceFrames(output->inner, m_timeline.pairInnerIndices);
+            submitSourceFrames(output->cover, m_timeline.pairCoverIndices);
+        }
+        for (uint32_t j = 0; j < pairCount; ++j) {
+            for (size_t v = 0; v < m_outputs.size(); ++v) {
+                m_pool.submit([self, v, j]() { self->generateFrame(v, j); });
+            }
+        }
+    }
+
+  private:
+    struct Output {
+        const GIFMirage::Options::Variant& variant;
+        CoverMask coverMask;
+        std::shared_ptr<DitheredFrameCache> inner;
+        std::shared_ptr<DitheredFrameCache> cover;
+        vector<vector<uint8_t>> frames;  // compressed, per pair
+        std::atomic<uint32_t> remaining{0};
+
+        // pairs of different source frames may still show the same planes, those are compressed once
+        std::mutex planesMutex;
+        std::map<std::pair<const BitPlane*, const BitPlane*>, uint32_t> planePairs;
+        vector<uint32_t> sameAs;  // pair -> pair holding its compressed frame
+
+        explicit Output(const GIFMirage::Options::Variant& variant)
+            : variant(variant), coverMask(variant.mergeMode, variant.width, variant.height) {}
+    };
+
+    void
+    generateFrame(const size_t v, const uint32_t j) noexcept {
+        auto& output = *m_outputs[v];
+        try {
+            const BitPlane* innerFrame = output.inner->get(m_timeline.pairInnerIndices[j]);
+            const BitPlane* coverFrame = output.cover->get(m_timeline.pairCoverIndices[j]);
+            bool isFirst               = true;
+            if (innerFrame && coverFrame) {
+                std::lock_guard<std::mutex> lock(output.planesMutex);
+                const auto [it, inserted] = output.planePairs.try_emplace({innerFrame, coverFrame}, j);
+                output.sameAs[j]          = it->second;
+                isFirst                   = inserted;
+            }
+            if (innerFrame && coverFrame && isFirst) {
+                output.frames[j] = compressFrame(
+                    *innerFrame, *coverFrame, output.coverMask, output.variant.width, output.variant.height);
+            }
+        } catch (const std::exception& e) {
+            GeneralLogger::error(std::string("Failed to generate frame: ") + e.what());
+        }
+        if (m_verbose) {
+            const size_t total = m_outputs.size() * output.frames.size();
+            const size_t done  = ++m_generatedFrames;
+            if (done % 10 == 0) {
+                GeneralLogger::info(std::to_string(done) + " of " + std::to_string(total) + " frames processed.",
+                                    GeneralLogger::STEP);
+            }
+        }
+        if (--output.remaining == 0) {
+            writeOutput(output);
+        }
+    }
+
+    void
+    writeOutput(Output& output) noexcept {
+        vector<uint32_t> framePairs(m_timeline.framePairs.size());
+        for (size_t i = 0; i < framePairs.size(); ++i) {
+            framePairs[i] = output.sameAs[m_timeline.framePairs[i]];
+        }
+        bool success = false;
+        if (output.variant.outputFile) {
+            success = writeGIF(m_args, output.variant, *output.variant.outputFile, output.frames, framePairs);
+        } else if (auto outputFile = NaiveIO::FileWriter::create(output.variant.outputPath, ".gif")) {
+            success = writeGIF(m_args, output.variant, *outputFile, output.frames, framePairs);
+        }
+        // release what is no longer needed before the other outputs are done
+        output.frames = {};
+        output.planePairs.clear();
+        output.inner.reset();
+        output.cover.reset();
+        if (!success) {
+            m_success = false;
+        }
+        if (--m_remainingOutputs == 0) {
+            releaseSources();
+            m_onDone(m_success);
+        }
+    }
+
+    // every frame has been generated, the files are not read anymore
+    void
+    releaseSources() noexcept {
+        for (const auto& image : m_sources) {
+            m_cache.release(image);
+        }
+        m_sources.clear();
+    }
+
+    const GIFMirage::Options& m_args;
+    SourceCache& m_cache;
+    TaskPool& m_pool;
+    bool m_verbose = false;
+    DoneCallback m_onDone;
+
+    Timeline m_timeline;
+    vector<std::unique_ptr<Output>> m_outputs;
+    vector<std::shared_ptr<GIFImage::ImageSequence>> m_sources;  // one per successful get from the cache
+    std::atomic<size_t> m_remainingOutputs{0};
+    std::atomic<size_t> m_generatedFrames{0};
+    std::atomic<bool> m_success{true};
+};
+
+static void
+logPoolStats(const TaskPool& pool, const std::chrono::steady_clock::time_point startTime) {
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    const auto& stats    = pool.getStats();
+    for (size_t i = 0; i < stats.size(); ++i) {
+        char statsBuffer[128];
+        snprintf(statsBuffer,
+                 sizeof(statsBuffer),
+                 "Thread %zu: %zu tasks (%zu stolen), utilization %.1f%%",
+                 i,
+                 stats[i].tasks,
+                 stats[i].stolen,
+                 elapsed > 0 ? stats[i].busySeconds / elapsed * 100 : 0.0);
+        GeneralLogger::info(statsBuffer, GeneralLogger::DETAIL);
+    }
+}
+
+bool
+GIFMirage::gifMirageEncode(const GIFMirage::Options& args) {
+    GeneralLogger::info("Starting GIF mirage encoding...");
+    for (const auto& variant : args.variants) {
+        GeneralLogger::info("Output file: " + variant.outputPath + " (" + std::to_string(variant.width) + "x" +
+                                std::to_string(variant.height) + ", " + variant.mergeMode.toString() + ")",
+                            GeneralLogger::STEP);
+    }
+    GeneralLogger::info("Number of frames: " + std::to_string(args.frameCount), GeneralLogger::STEP);
+    GeneralLogger::info("Frame duration: " + std::to_string(args.delay), GeneralLogger::STEP);
+
+    if (!args.innerImage || !args.coverImage) {
+        return false;
+    }
+
+    GeneralLogger::info("Generating frames...");
+    GeneralLogger::info(std::string("Thread count: ") + std::to_string(args.threadCount), GeneralLogger::STEP);
+
+    const auto startTime = std::chrono::steady_clock::now();
+    TaskPool pool(args.threadCount);
+    // variants of the same size share their dithered source frames,
+    // only merging and compressing is done per variant
+    SourceCache cache(0);
+    bool success   = false;
+    const auto job = std::make_shared<MirageJob>(args, cache, pool, true, [&success](const bool ok) { success = ok; });
+    job->start();
+    pool.wait();
+
+    logPoolStats(pool, startTime);
+    return success;
+}
+
+bool
+GIFMirage::gifMirageBatch(const GIFMirage::BatchOptions& batch) {
+    GeneralLogger::info("Starting GIF mirage batch...");
+    GeneralLogger::info("Manifest: " + batch.manifestPath, GeneralLogger::STEP);
+    GeneralLogger::info("Number of jobs: " + std::to_string(batch.jobs.size()), GeneralLogger::STEP);
+    GeneralLogger::info("Thread count: " + std::to_string(batch.threadCount), GeneralLogger::STEP);
+    GeneralLogger::info("Source cache size: " + std::to_string(batch.cacheSize), GeneralLogger::STEP);
+    GeneralLogger::info("Frame cache budget: " + std::to_string(batch.maxFrameCacheMB) + " MB", GeneralLogger::STEP);
+
+    const auto startTime = std::chrono::steady_clock::now();
+    TaskPool pool(batch.threadCount);
+    SourceCache cache(batch.cacheSize);
+
+    // jobs in progress hold their sources and compressed frames, so only a few are started at once
+    const size_t maxRunning = pool.getThreadCount() * 2;
+    std::mutex mutex;
+    std::condition_variable doneCv;
+    size_t running = 0, finished = 0, failed = 0;
+
+    for (size_t i = 0; i < batch.jobs.size(); ++i) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            doneCv.wait(lock, [&running, maxRunning]() { return running < maxRunning; });
+            ++running;
+        }
+        const auto job = std::make_shared<MirageJob>(
+            batch.jobs[i], cache, pool, false, [&batch, &mutex, &doneCv, &running, &finished, &failed, i](const bool ok) {
+                std::lock_guard<std::mutex> lock(mutex);
+                --running;
+                ++finished;
+                if (!ok) {
+                    ++failed;
+                    GeneralLogger::error("Job " + std::to_string(i + 1) + " failed.");
+                }
+                if (finished % 10 == 0) {
+                    GeneralLogger::info(
+                        std::to_string(finished) + " of " + std::to_string(batch.jobs.size()) + " jobs done.",
+                        GeneralLogger::STEP);
+                }
+                doneCv.notify_all();
+            });
+        pool.submit([job]() { job->start(); });
+    }
+    pool.wait();
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    char summary[128];
+    snprintf(summary,
+             sizeof(summary),
+             "%zu jobs (%zu failed) in %.2fs, %.2f jobs/s",
+             finished,
+             failed,
+             elapsed,
+             elapsed > 0 ? finished / elapsed : 0.0);
+    GeneralLogger::info(summary);
+    GeneralLogger::info("Source cache: " + std::to_string(cache.getHits()) + " hits, " +
+                            std::to_string(cache.getMisses()) + " misses",
+                        GeneralLogger::DETAIL);
+    logPoolStats(pool, startTime);
+    return failed == 0;
+}
@@ -1,19 +1,47 @@
 #include "gif_options.h"
 
+#include <cctype>
+#include <filesystem>
+#include <span>
+#include <sstream>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "cxxopts.hpp"
+#include "file_reader.h"
+#include "file_utils.h"
 #include "log.h"
 
 using namespace GIFMirage;
-using std::string;
-
-static constexpr uint32_t DEFAULT_THREADS = 4;
+using std::string, std::vector;
 
 static uint32_t
 getThreadCount() {
     uint32_t threadCount = std::thread::hardware_concurrency();
-    return threadCount == 0 ? 1 : (threadCount > DEFAULT_THREADS ? DEFAULT_THREADS : threadCount);
+    return threadCount == 0 ? 1 : threadCount;
+}
+
+static vector<string>
+splitList(const string& str) {
+    vector<string> ret;
+    std::stringstream stream(str);
+    string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) ret.push_back(item);
+    }
+    return ret;
+}
+
+// "out.gif" -> "out-S2W1C-640x640.gif", only the parts that differ between the variants are appended
+static string
+getVariantPath(const string& outputPath, const string& suffix) {
+    const auto slash = outputPath.find_last_of("/\\");
+    const auto dot   = outputPath.rfind('.');
+    if (dot != string::npos && (slash == string::npos || dot > slash)) {
+        return outputPath.substr(0, dot) + suffix + ".gif";
+    }
+    return outputPath + suffix + ".gif";
 }
 
 class OptionInvalidException final : public std::exception {
@@ -31,7 +59,7 @@ class OptionInvalidException final : public std::exception {
 };
 
 std::optional<Options>
-Options::parseArgs(int argc, char** argv) noexcept {
+Options::parseArgs(int argc, char** argv, const bool openFiles) noexcept {
     cxxopts::Options options("GIFMirage", "GIF Mirage Generator");
 
     options.add_options()
@@ -66,12 +94,28 @@ Options::parseArgs(int argc, char** argv) noexcept {
          "Number of threads to use for processing, 0 = auto-detect.",
          cxxopts::value<uint32_t>()->default_value(std::to_string(Defaults::threadCount)))
         //
+        ("max-frame-cache-mb",
+         "Memory budget in MB for the decoded frames of each input, 0 = unlimited.",
+         cxxopts::value<uint32_t>()->default_value(std::to_string(GIFImage::ReadOptions::DEFAULT_MAX_FRAME_CACHE_MB)))
+        //
+        ("decoder-threads",
+         "Number of threads to decode each video input with, 0 = auto-detect. Jobs of a batch default to 1.",
+         cxxopts::value<uint32_t>()->default_value("0"))
+        //
         ("m,mode", mergeModeHint, cxxopts::value<string>()->default_value(Defaults::mergeMode))
         //
+        ("sizes",
+         "Comma separated output sizes (e.g. 640x640,320x320), one GIF each. Overrides width and height.",
+         cxxopts::value<string>())
+        //
         ("h,help", "Show help message");
 
     options.positional_help("<inner-image> <cover-image>");
     options.parse_positional({"inner", "cover"});
+    // not for every line of a batch manifest
+    const auto showHelp = [&options, openFiles]() {
+        if (openFiles) std::cout << options.help() << std::endl;
+    };
 
     try {
         auto result = options.parse(argc, argv);
@@ -84,70 +128,137 @@ Options::parseArgs(int argc, char** argv) noexcept {
         if (!result.count("inner") || !result.count("cover")) {
             throw OptionInvalidException("'inner' and 'cover' arguments are required.");
         }
+        // jobs of a batch share the threads and the frame cache budget of the batch
+        if (!openFiles && result.count("threads")) {
+            throw OptionInvalidException("'threads' is set for the whole batch, not per job.");
+        }
+        if (!openFiles && result.count("max-frame-cache-mb")) {
+            throw OptionInvalidException("'max-frame-cache-mb' is set for the whole batch, not per job.");
+        }
 
-        const auto modeRef = GIFMirage::MergeMode::parse(result["mode"].as<string>());
-        if (!modeRef) {
+        vector<MergeMode> modes;
+        for (const auto& item : splitList(result["mode"].as<string>())) {
+            const auto modeRef = GIFMirage::MergeMode::parse(item);
+            if (!modeRef) {
+                throw OptionInvalidException("Invalid merge mode: " + item);
+            }
+            modes.push_back(*modeRef);
+        }
+        if (modes.empty()) {
             throw OptionInvalidException("Invalid merge mode: " + result["mode"].as<string>());
         }
-        const auto& mode = *modeRef;
+
+        vector<std::pair<uint32_t, uint32_t>> sizes;
+        if (result.count("sizes")) {
+            for (const auto& item : splitList(result["sizes"].as<string>())) {
+                const auto x = item.find('x');
+                if (x == string::npos) {
+                    throw OptionInvalidException("Invalid size: " + item);
+                }
+                try {
+                    sizes.emplace_back(std::stoul(item.substr(0, x)), std::stoul(item.substr(x + 1)));
+                } catch (...) {
+                    throw OptionInvalidException("Invalid size: " + item);
+                }
+            }
+        } else {
+            sizes.emplace_back(result["width"].as<uint32_t>(), result["height"].as<uint32_t>());
+        }
+        if (sizes.empty() || modes.size() * sizes.size() > Limits::variants) {
+            throw OptionInvalidException("Between 1 and " + std::to_string(Limits::variants) + " outputs are allowed.");
+        }
 
         Options gifOptions;
         gifOptions.innerPath      = result["inner"].as<string>();
         gifOptions.coverPath      = result["cover"].as<string>();
-        gifOptions.innerImage     = GIFImage::ImageSequence::read(result["inner"].as<string>());
-        gifOptions.coverImage     = GIFImage::ImageSequence::read(result["cover"].as<string>());
         gifOptions.outputPath     = result["output"].as<string>();
-        gifOptions.outputFile     = NaiveIO::FileWriter::create(gifOptions.outputPath, ".gif");
-        gifOptions.width          = result["width"].as<uint32_t>();
-        gifOptions.height         = result["height"].as<uint32_t>();
         gifOptions.frameCount     = result["frames"].as<uint32_t>();
         gifOptions.delay          = result["duration"].as<uint32_t>();
-        gifOptions.mergeMode      = mode;
         gifOptions.threadCount    = result["threads"].as<uint32_t>();
         gifOptions.disposalMethod = result["disposal"].as<uint32_t>();
 
+        gifOptions.readOptions.maxFrameCacheMB = result["max-frame-cache-mb"].as<uint32_t>();
+        gifOptions.readOptions.decoderThreads  = result["decoder-threads"].as<uint32_t>();
+        // jobs of a batch already run side by side on all cores
+        if (!openFiles && !result.count("decoder-threads")) {
+            gifOptions.readOptions.decoderThreads = 1;
+        }
+
+        for (const auto& [width, height] : sizes) {
+            for (const auto& mode : modes) {
+                string suffix;
+                if (modes.size() > 1) suffix += "-" + mode.toString();
+                if (sizes.size() > 1) suffix += "-" + std::to_string(width) + "x" + std::to_string(height);
+                auto& variant      = gifOptions.variants.emplace_back();
+                variant.mergeMode  = mode;
+                variant.width      = width;
+                variant.height     = height;
+                variant.outputPath = suffix.empty() ? gifOptions.outputPath
+                                                    : getVariantPath(gifOptions.outputPath, suffix);
+            }
+        }
+
+        if (openFiles) {
+            gifOptions.innerImage = GIFImage::ImageSequence::read(gifOptions.innerPath, gifOptions.readOptions);
+            gifOptions.coverImage = GIFImage::ImageSequence::read(gifOptions.coverPath, gifOptions.readOptions);
+            for (auto& variant : gifOptions.variants) {
+                variant.outputFile = NaiveIO::FileWriter::create(variant.outputPath, ".gif");
+            }
+        }
+
         if (gifOptions.threadCount == 0) {
             gifOptions.threadCount = getThreadCount();
         }
 
-        gifOptions.ensureValid();
+        gifOptions.ensureValid(openFiles);
 
         return gifOptions;
     } catch (const cxxopts::exceptions::parsing& e) {
         GeneralLogger::error("Error parsing command line arguments: " + string(e.what()));
-        std::cout << options.help() << std::endl;
+        showHelp();
         return std::nullopt;
     } catch (const OptionInvalidException& e) {
         GeneralLogger::error("Invalid argument: " + string(e.what()));
-        std::cout << options.help() << std::endl;
+        showHelp();
         return std::nullopt;
     } catch (const std::exception& e) {
         GeneralLogger::error("Unexpected error: " + string(e.what()));
-        std::cout << options.help() << std::endl;
+        showHelp();
         return std::nullopt;
     } catch (...) {
         GeneralLogger::error("Unexpected error.");
-        std::cout << options.help() << std::endl;
+        showHelp();
         return std::nullopt;
     }
 }
 
 void
-Options::ensureValid() const {
-    if (!innerImage) {
+Options::ensureValid(const bool openFiles) const {
+    if (openFiles && !innerImage) {
         throw OptionInvalidException("Invalid inner image.");
     }
-    if (!coverImage) {
+    if (openFiles && !coverImage) {
         throw OptionInvalidException("Invalid cover image.");
     }
-    if (!outputFile) {
-        throw OptionInvalidException("Invalid output path.");
-    }
-    if (width == 0 || height == 0) {
-        throw OptionInvalidException("Width and height must be positive integers.");
+    if (variants.empty()) {
+        throw OptionInvalidException("No output to generate.");
     }
-    if (width > Limits::width || height > Limits::height) {
-        throw OptionInvalidException("Width and height must be less than " + std::to_string(Limits::width) + ".");
+    for (size_t i = 0; i < variants.size(); ++i) {
+        const auto& variant = variants[i];
+        if (openFiles && !variant.outputFile) {
+            throw OptionInvalidException("Invalid output path.");
+        }
+        if (variant.width == 0 || variant.height == 0) {
+            throw OptionInvalidException("Width and height must be positive integers.");
+        }
+        if (variant.width > Limits::width || variant.height > Limits::height) {
+            throw OptionInvalidException("Width and height must be less than " + std::to_string(Limits::width) + ".");
+        }
+        for (size_t j = 0; j < i; ++j) {
+            if (variants[j].outputPath == variant.outputPath) {
+                throw OptionInvalidException("Duplicate output: " + variant.outputPath);
+            }
+        }
     }
     if (frameCount == 0) {
         throw OptionInvalidException("Frame count must be positive.");
@@ -167,6 +278,167 @@ Options::ensureValid() const {
     }
 }
 
+// split a manifest line into arguments, double quotes group words
+static vector<string>
+splitArguments(const string& line) {
+    vector<string> ret;
+    string current;
+    bool quoted   = false;
+    bool hasToken = false;
+    for (const char c : line) {
+        if (c == '"') {
+            quoted   = !quoted;
+            hasToken = true;
+        } else if (!quoted && std::isspace(static_cast<unsigned char>(c))) {
+            if (hasToken) {
+                ret.push_back(std::move(current));
+                current.clear();
+                hasToken = false;
+            }
+        } else {
+            current += c;
+            hasToken = true;
+        }
+    }
+    if (quoted) {
+        throw OptionInvalidException("Unterminated quote: " + line);
+    }
+    if (hasToken) {
+        ret.push_back(std::move(current));
+    }
+    return ret;
+}
+
+// the file an output path is written to, as FileWriter names it, to tell paths apart that are spelled differently
+static string
+getOutputKey(const string& outputPath) {
+    auto path = std::filesystem::path(NaiveIO::localizePath(outputPath));
+    path.replace_extension(".gif");
+    std::error_code error;
+    auto canonical = std::filesystem::absolute(path, error);
+    if (!error) canonical = std::filesystem::weakly_canonical(canonical, error);
+    return NaiveIO::deLocalizePath(error ? path.lexically_normal() : canonical);
+}
+
+static string
+readManifest(const string& path) {
+    const auto reader = NaiveIO::FileReader::create(path);
+    if (!reader) {
+        throw OptionInvalidException("Failed to open manifest: " + path);
+    }
+    string content(reader->getSize(), '\0');
+    std::span<uint8_t> buffer(reinterpret_cast<uint8_t*>(content.data()), content.size());
+    content.resize(reader->read(buffer));
+    return content;
+}
+
+bool
+BatchOptions::isBatch(int argc, char** argv) noexcept {
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--batch" || arg.starts_with("--batch=")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::optional<BatchOptions>
+BatchOptions::parseArgs(int argc, char** argv) noexcept {
+    cxxopts::Options options("GIFMirage", "GIF Mirage Generator, batch mode");
+
+    options.add_options()
+        //
+        ("batch", "Manifest file, one job per line with the arguments of a single run.", cxxopts::value<string>())
+        //
+        ("p,threads",
+         "Number of threads shared by all jobs, 0 = auto-detect.",
+         cxxopts::value<uint32_t>()->default_value(std::to_string(Defaults::threadCount)))
+        //
+        ("cache",
+         "Number of prepared sources (file and size) kept for later jobs.",
+         cxxopts::value<uint32_t>()->default_value(std::to_string(Defaults::cacheSize)))
+        //
+        ("max-frame-cache-mb",
+         "Memory budget in MB for the decoded frames of all inputs open at once, 0 = unlimited.",
+         cxxopts::value<uint32_t>()->default_value(std::to_string(Defaults::maxFrameCacheMB)))
+        //
+        ("h,help", "Show help message");
+
+    try {
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return std::nullopt;
+        }
+        if (!result.count("batch")) {
+            throw OptionInvalidException("'batch' argument is required.");
+        }
+
+        BatchOptions batchOptions;
+        batchOptions.manifestPath = result["batch"].as<string>();
+        batchOptions.threadCount  = result["threads"].as<uint32_t>();
+        batchOptions.cacheSize       = result["cache"].as<uint32_t>();
+        batchOptions.maxFrameCacheMB = result["max-frame-cache-mb"].as<uint32_t>();
+        if (batchOptions.threadCount == 0) {
+            batchOptions.threadCount = getThreadCount();
+        }
+        std::shared_ptr<GIFImage::FrameCacheBudget> frameCache;
+        if (batchOptions.maxFrameCacheMB > 0) {
+            frameCache =
+                std::make_shared<GIFImage::FrameCacheBudget>(static_cast<size_t>(batchOptions.maxFrameCacheMB) << 20);
+        }
+
+        std::unordered_map<string, uint32_t> outputLines;  // line of the job writing each output
+
+        std::stringstream manifest(readManifest(batchOptions.manifestPath));
+        string line;
+        for (uint32_t lineNumber = 1; std::getline(manifest, line); ++lineNumber) {
+            auto args = splitArguments(line);
+            if (args.empty() || args.front().starts_with('#')) {
+                continue;
+            }
+            args.insert(args.begin(), "GIFMirage");
+            vector<char*> jobArgv;
+            for (auto& arg : args) {
+                jobArgv.push_back(arg.data());
+            }
+            auto job = Options::parseArgs(static_cast<int>(jobArgv.size()), jobArgv.data(), false);
+            if (!job) {
+                throw OptionInvalidException("Invalid job on line " + std::to_string(lineNumber) + ".");
+            }
+            for (const auto& variant : job->variants) {
+                const auto [it, inserted] = outputLines.emplace(getOutputKey(variant.outputPath), lineNumber);
+                if (!inserted && it->second != lineNumber) {
+                    throw OptionInvalidException("Duplicate output on lines " + std::to_string(it->second) + " and " +
+                                                 std::to_string(lineNumber) + ": " + variant.outputPath);
+                }
+            }
+            job->readOptions.maxFrameCacheMB  = 0;
+            job->readOptions.sharedFrameCache = frameCache;
+            batchOptions.jobs.push_back(std::move(*job));
+        }
+        if (batchOptions.jobs.empty()) {
+            throw OptionInvalidException("No job in manifest: " + batchOptions.manifestPath);
+        }
+        return batchOptions;
+    } catch (const cxxopts::exceptions::parsing& e) {
+        GeneralLogger::error("Error parsing command line arguments: " + string(e.what()));
+        std::cout << options.help() << std::endl;
+        return std::nullopt;
+    } catch (const OptionInvalidException& e) {
+        GeneralLogger::error("Invalid argument: " + string(e.what()));
+        return std::nullopt;
+    } catch (const std::exception& e) {
+        GeneralLogger::error("Unexpected error: " + string(e.what()));
+        return std::nullopt;
+    } catch (...) {
+        GeneralLogger::error("Unexpected error.");
+        return std::nullopt;
+    }
+}
+
 std::optional<MergeMode>
 MergeMode::parse(const std::string& str) noexcept {
     MergeMode mode;
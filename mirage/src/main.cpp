@@ -20,6 +20,13 @@ main(int argc, char** argv) {
     if (!GIFImage::ImageSequence::initDecoder(argv[0])) {
         return 1;
     }
+    if (GIFMirage::BatchOptions::isBatch(argc, argv)) {
+        const auto batch = GIFMirage::BatchOptions::parseArgs(argc, argv);
+        if (!batch) {
+            return 1;
+        }
+        return GIFMirage::gifMirageBatch(*batch) ? 0 : 1;
+    }
     auto options = GIFMirage::Options::parseArgs(argc, argv);
     if (!options) {
         return 1;
@@ -35,19 +35,39 @@ def process_mirage():
     if return_code != 0:
         exit(return_code)
 
-    for s in range(5):
-        for w in range(1, 5):
-            for suffix in ["C", "R"]:
-                mode = f"S{s}W{w}{suffix}"
-                return_code = execute_program(exe_path, [
-                    os.path.join(script_root, "..", "images", "气气.gif"),
-                    os.path.join(script_root, "..", "images", "马达.gif"),
-                    "-o", os.path.join(script_root, "mirage", mode),
-                    "-m", mode,
-                    "-p", "12"
-                ])
-                if return_code != 0:
-                    exit(return_code)
+    # all merge modes in one run, the inputs are only prepared once
+    modes = [f"S{s}W{w}{suffix}" for s in range(5) for w in range(1, 5) for suffix in ["C", "R"]]
+    return_code = execute_program(exe_path, [
+        os.path.join(script_root, "..", "images", "气气.gif"),
+        os.path.join(script_root, "..", "images", "马达.gif"),
+        "-o", os.path.join(script_root, "mirage", "mode"),
+        "-m", ",".join(modes),
+        "-p", "12"
+    ])
+    if return_code != 0:
+        exit(return_code)
+
+    return_code = execute_program(exe_path, [
+        os.path.join(script_root, "..", "images", "气气.gif"),
+        os.path.join(script_root, "..", "images", "马达.gif"),
+        "-o", os.path.join(script_root, "mirage", "sizes"),
+        "-m", "S2W1C,S1W2R",
+        "--sizes", "640x640,320x240"
+    ])
+    if return_code != 0:
+        exit(return_code)
+
+    # several jobs in one process, the recurring sources are only prepared once
+    images = os.path.join(script_root, "..", "images")
+    manifest_path = os.path.join(script_root, "mirage", "batch.txt")
+    os.makedirs(os.path.dirname(manifest_path), exist_ok=True)
+    with open(manifest_path, "w", encoding="utf-8") as manifest:
+        for i, (inner, cover) in enumerate([("气气.gif", "马达.gif"), ("马达.gif", "气气.gif"), ("气气.gif", "马达.gif")]):
+            output = os.path.join(script_root, "mirage", f"batch-{i}")
+            manifest.write(f'"{os.path.join(images, inner)}" "{os.path.join(images, cover)}" -o "{output}" -m S{i}W1C\n')
+    return_code = execute_program(exe_path, ["--batch", manifest_path, "-p", "12"])
+    if return_code != 0:
+        exit(return_code)
 
 
 if __name__ == "__main__":